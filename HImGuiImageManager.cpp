@@ -14,11 +14,24 @@
 #include <iostream>
 #include "imgui_internal.h"
 #include <fstream>
-#if HIMAGE_MANAGER_URL_IMAGE_ENABLED || HIMAGE_MANAGER_GIF_IMAGE_ENABLED
 #include <thread>
-
-#else
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <functional>
 #include <chrono>
+#include <list>
+#include <queue>
+#include <string.h>
+#include <limits.h>
+#include <algorithm>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define HIMAGE_MANAGER_SSE2 1
+#include <emmintrin.h>
+#else
+#define HIMAGE_MANAGER_SSE2 0
 #endif
 
 #if HIMAGE_MANAGER_URL_IMAGE_ENABLED
@@ -28,213 +41,2727 @@
 #include "httplib.h"
 #endif // HIMAGE_MANAGER_URL_IMAGE_ENABLED
 
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 #if !defined(STBI_VERSION)
 #error Need to include third-party libraries ("stb_image.h")
 #endif // (STBI_VERSION)
+#if HIMAGE_MANAGER_GIF_IMAGE_ENABLED && (!defined(STB_IMAGE_IMPLEMENTATION) || defined(STBI_NO_GIF))
+#error The gif decoding uses stb_image internals : this file must be the one compiling stb_image (STB_IMAGE_IMPLEMENTATION, without STBI_NO_GIF)
+#endif
+
+//64-bit FNV-1a of the file name / url id. The cache maps are keyed by it so a lookup never builds a std::string (collisions are not checked)
+inline uint64_t HashImageKey(const char* key)
+{
+	uint64_t hash = 14695981039346656037ull;
+	for (; *key; key++)
+	{
+		hash ^= (unsigned char)*key;
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+//64-bit FNV-1a over 8 byte words, for whole file contents
+inline uint64_t HashBytes(const unsigned char* data, size_t size, uint64_t hash = 14695981039346656037ull)
+{
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8)
+	{
+		uint64_t word;
+		memcpy(&word, data + i, 8);
+		hash ^= word;
+		hash *= 1099511628211ull;
+	}
+	for (; i < size; i++)
+	{
+		hash ^= data[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+//Borrowed image bytes, identified by the caller's key or else by their content. Mixed so they do not meet file name keys
+inline uint64_t HashImageKey(const void* data, size_t size, uint64_t key)
+{
+	uint64_t hash = (key ? key : HashBytes((const unsigned char*)data, size)) ^ 0x9e3779b97f4a7c15ull;
+	hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ull;
+	hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebull;
+	return hash ^ (hash >> 31);
+}
+
+//Content keys of the HBitImage vectors by their address, so a cache hit does not hash the bytes. UI thread only
+struct HBitImageKey
+{
+	const unsigned char* data = 0;
+	size_t size = 0;
+	uint64_t key = 0;
+};
+std::unordered_map<const HBitImage*, HBitImageKey> BitImageKeys;
+
+inline uint64_t HashImageKey(const HBitImage& bit_image, size_t size)
+{
+	HBitImageKey& cached = BitImageKeys[&bit_image];
+	if (cached.data != bit_image.data() || cached.size != size || !cached.key)
+	{
+		cached.data = bit_image.data();
+		cached.size = size;
+		cached.key = HashImageKey(bit_image.data(), size, 0);
+	}
+	return cached.key;
+}
+
+//Whole file contents for the decoders. Mapped read-only when possible, otherwise read into memory with pread / ReadFile
+class HFileSource
+{
+public:
+	static std::shared_ptr<HFileSource> Open(const char* path)
+	{
+		std::shared_ptr<HFileSource> source(new HFileSource());
+#ifdef _WIN32
+		HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+		if (file == INVALID_HANDLE_VALUE)
+			return 0;
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(file, &size))
+		{
+			CloseHandle(file);
+			return 0;
+		}
+		source->size = (size_t)size.QuadPart;
+		HANDLE mapping = size.QuadPart > 0 ? CreateFileMappingA(file, 0, PAGE_READONLY, 0, 0, 0) : 0;
+		if (mapping)
+		{
+			source->mapped = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+			CloseHandle(mapping);
+		}
+		if (!source->mapped && !source->ReadAll(file))
+			source.reset();
+		CloseHandle(file);
+#else
+		int fd = open(path, O_RDONLY);
+		if (fd < 0)
+			return 0;
+		struct stat st;
+		if (fstat(fd, &st) != 0)
+		{
+			close(fd);
+			return 0;
+		}
+		source->size = (size_t)st.st_size;
+		if (st.st_size > 0)
+		{
+			void* data = mmap(0, source->size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (data != MAP_FAILED)
+				source->mapped = data;
+		}
+		if (!source->mapped && !source->ReadAll(fd))
+			source.reset();
+		close(fd);
+#endif
+		if (source)
+			source->data = source->mapped ? (unsigned char*)source->mapped : source->buffer.data();
+		return source;
+	}
+
+	//Copy of a memory buffer, for decoders that outlive it
+	static std::shared_ptr<HFileSource> FromMemory(const unsigned char* data, size_t size)
+	{
+		std::shared_ptr<HFileSource> source(new HFileSource());
+		source->buffer.assign(data, data + size);
+		source->data = source->buffer.data();
+		source->size = size;
+		return source;
+	}
+
+	~HFileSource()
+	{
+		if (!mapped)
+			return;
+#ifdef _WIN32
+		UnmapViewOfFile(mapped);
+#else
+		munmap(mapped, size);
+#endif
+	}
+
+	unsigned char* data = 0;
+	size_t size = 0;
+
+private:
+	HFileSource() {}
+
+#ifdef _WIN32
+	bool ReadAll(HANDLE file)
+	{
+		buffer.resize(size);
+		for (size_t done = 0; done < size;)
+		{
+			DWORD read = 0;
+			if (!ReadFile(file, buffer.data() + done, (DWORD)std::min<size_t>(size - done, 1 << 30), &read, 0) || read == 0)
+				return false;
+			done += read;
+		}
+		return true;
+	}
+#else
+	bool ReadAll(int fd)
+	{
+		buffer.resize(size);
+		for (size_t done = 0; done < size;)
+		{
+			ssize_t read = pread(fd, buffer.data() + done, size - done, (off_t)done);
+			if (read <= 0)
+				return false;
+			done += (size_t)read;
+		}
+		return true;
+	}
+#endif
+
+	void* mapped = 0;
+	std::vector<unsigned char> buffer;
+};
+
+struct HImageKeyHash
+{
+	inline size_t operator()(uint64_t key) const { return (size_t)key; }
+};
+
+//Position of a cached image in the eviction order
+struct HCacheRef
+{
+	int kind;
+	uint64_t key;
+};
 
 struct HImageInfo
 {
+	std::string id;  //Name shown by ShowResourceManager
 	DeleteTextureCallback unload = 0;
 	float life_cycle = 1.5;
 	HImage image;
+	int format = 0;  //HTexture::format of the texture
+
+	size_t bytes = 0;
+	double last_used_time = 0;  //CacheTime of the last hit, the entry expires life_cycle seconds later
+	unsigned int expiry_serial = 0;
+	int last_used_frame = 0;
+	bool referenced = false;  //Clock policy, set by every cache hit
+	int atlas_page = -1;      //IO.SmallImageAtlasMaxSide : index in AtlasPages, the texture belongs to the page
+	unsigned int atlas_slot = 0;
+	uint64_t content_key = 0; //IO.DeduplicateContent : the texture belongs to SharedTextures
+	std::list<HCacheRef>::iterator order;
+};
+
+//Pending asynchronous load. Workers run the highest priority first, the priority being the last frame the image was asked for
+struct HLoadRequest
+{
+	uint64_t key = 0;
+	std::string id;
+	std::atomic<int> priority{ 0 };
+	std::atomic<bool> cancelled{ false };
+	bool preload = false;  //HImageManager::Preload, never cancelled for not being asked for
+	float min_life_cycle = 0;  //HImageManager::Preload joining a queued load, the entry then lives at least this long
 };
 #if HIMAGE_MANAGER_GIF_IMAGE_ENABLED
+struct HGifStream;
+struct HGifCompactFrames;
+
 struct HImageInfo_gif : public HImageInfo
 {
 	int frames = 1;
-	int* delays;
+	int* delays = 0;
 	unsigned char* data = 0;
+	std::shared_ptr<HGifStream> stream;  //IO.GifStreaming, replaces data and delays
+	std::shared_ptr<HGifCompactFrames> compact;  //IO.GifCompactFrames, replaces data
+
+	int shown_frame = 0;  //Frame currently in the texture
+
+	//Playback, advanced once per frame by HImageManager::updata from CacheTime
+	float speed = 1000;          //Delays are divided by it to get seconds
+	CreateTextureCallback load = 0;
+	double start_time = 0;
+	std::vector<int> frame_end;  //Delay units from the start of the loop to the end of each frame
+	double next_frame_units = 0; //Streams : when the next frame is due, in delay units since start_time
 
-	int current_frame = 1;
-	float delay_buffer = 0;
+	//Frame atlas (IO.GifFrameAtlas) : frames are laid out in pages of atlas_columns, data is freed once the pages are uploaded
+	int atlas_columns = 0;
+	int atlas_frames_per_page = 0;
+	int atlas_width = 0, atlas_height = 0;
+	std::vector<HTextureID> atlas_pages;
 
 	inline unsigned char* get_frame_image(int frame) {
 		return data + ((long long)image.width * image.height * 4 * frame);
 	}
 
+	inline bool IsAtlas() const { return atlas_columns > 0; }
+	inline int AtlasPageCount() const { return (frames + atlas_frames_per_page - 1) / atlas_frames_per_page; }
+	inline size_t AtlasPageBytes() const { return (size_t)atlas_width * atlas_height * 4; }
+
+	void SetAtlasFrame(int frame)
+	{
+		int index = frame % atlas_frames_per_page;
+		float x = (float)(index % atlas_columns) * image.width;
+		float y = (float)(index / atlas_columns) * image.height;
+		image.texture = atlas_pages[frame / atlas_frames_per_page];
+		image.uv_min = ImVec2(x / atlas_width, y / atlas_height);
+		image.uv_max = ImVec2((x + image.width) / atlas_width, (y + image.height) / atlas_height);
+	}
+
+	size_t CacheBytes() const;  //Textures plus the frames kept on the cpu side
+
 	inline int get_frame_delay(int frame) {
 		return delays[frame]; // don't remember what the /10 was all about, probably just time unit conversion
 	}
 };
 
+
+//IO.GifStreaming : keeps the compressed gif and decodes a few frames ahead of the playhead on the thread pool, looping forever.
+//The decoder state is only touched by one Fill task at a time, the ring is shared with the UI thread under the mutex.
+struct HGifStream
+{
+	HGifStream(std::shared_ptr<HFileSource> source, int frames_ahead) : file(source)
+	{
+		ring_size = frames_ahead > 0 ? frames_ahead : 1;
+		memset(&gif, 0, sizeof(gif));
+		stbi__start_mem(&context, file->data, (int)file->size);
+		request = std::make_shared<HLoadRequest>();
+	}
+
+	~HGifStream()
+	{
+		FreeDecoder();
+	}
+
+	//Decodes the first frame into shown, called once before the stream is shared
+	bool Open()
+	{
+		if (!DecodeNext(shown_delay))
+			return false;
+		frame_bytes = last.size();
+		shown = last;
+		next.resize(frame_bytes);
+		ring.resize(frame_bytes * ring_size);
+		ring_delays.resize(ring_size);
+		return true;
+	}
+
+	void Fill()
+	{
+		while (true)
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				if (ring_count >= ring_size || failed)
+					break;
+			}
+			int delay;
+			bool decoded = DecodeNext(delay);
+			std::lock_guard<std::mutex> lock(mutex);
+			if (!decoded)
+			{
+				failed = true;
+				break;
+			}
+			int slot = (ring_head + ring_count) % ring_size;
+			memcpy(ring.data() + frame_bytes * slot, last.data(), frame_bytes);
+			ring_delays[slot] = delay;
+			ring_count++;
+		}
+	}
+
+	bool NeedsFill()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return ring_count < ring_size && !failed;
+	}
+
+	//UI thread : takes the next frame into next
+	bool Pop(int& delay)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (ring_count == 0)
+			return false;
+		memcpy(next.data(), ring.data() + frame_bytes * ring_head, frame_bytes);
+		delay = ring_delays[ring_head];
+		ring_head = (ring_head + 1) % ring_size;
+		ring_count--;
+		return true;
+	}
+
+	size_t MemoryBytes() const
+	{
+		return file->size + frame_bytes * (ring_size + 4);
+	}
+
+	int width() const { return gif.w; }
+	int height() const { return gif.h; }
+
+	std::vector<unsigned char> shown;  //UI thread : frame in the texture
+	std::vector<unsigned char> next;
+	int shown_delay = 0;  //Of the first frame
+	int comp = 0;
+	std::atomic<bool> filling{ false };  //A Fill task is queued or running, cleared by HGifFillGuard
+	std::shared_ptr<HLoadRequest> request;  //Priority of the Fill tasks
+
+private:
+	bool DecodeNext(int& delay)
+	{
+		for (int attempt = 0; attempt < 2; attempt++)
+		{
+			unsigned char* out = stbi__gif_load_next(&context, &gif, &comp, 4, decoded >= 2 ? two_back.data() : 0);
+			if (out && out != (unsigned char*)&context)
+			{
+				//Disposal method 3 restores the frame before the last one
+				two_back.swap(last);
+				last.assign(out, out + (size_t)gif.w * gif.h * 4);
+				decoded++;
+				delay = gif.delay;
+				return true;
+			}
+			if (decoded == 0)
+				return false;
+			FreeDecoder();  //End of the animation, start over
+		}
+		return false;
+	}
+
+	void FreeDecoder()
+	{
+		STBI_FREE(gif.out);
+		STBI_FREE(gif.history);
+		STBI_FREE(gif.background);
+		memset(&gif, 0, sizeof(gif));
+		stbi__start_mem(&context, file->data, (int)file->size);
+		decoded = 0;
+	}
+
+	std::shared_ptr<HFileSource> file;  //The gif file mapped, or a copy of memory input
+	stbi__context context;
+	stbi__gif gif;
+	int decoded = 0;  //Frames since the last restart
+	std::vector<unsigned char> last, two_back;
+	size_t frame_bytes = 0;
+
+	std::mutex mutex;
+	std::vector<unsigned char> ring;
+	std::vector<int> ring_delays;
+	int ring_size = 1, ring_head = 0, ring_count = 0;
+	bool failed = false;
+};
+
+struct HGifRect
+{
+	int x, y, w, h;
+};
+
+//Bounding box of the pixels that differ between two rgba frames, w is 0 when they are identical
+HGifRect GifDirtyRect(const unsigned char* a, const unsigned char* b, int w, int h)
+{
+	HGifRect rect = { 0, 0, 0, 0 };
+	size_t row = (size_t)w * 4;
+	int top = 0;
+	while (top < h && memcmp(a + top * row, b + top * row, row) == 0)
+		top++;
+	if (top == h)
+		return rect;
+	int bottom = h - 1;
+	while (bottom > top && memcmp(a + bottom * row, b + bottom * row, row) == 0)
+		bottom--;
+
+	int left = w, right = -1;
+	for (int r = top; r <= bottom; r++)
+	{
+		const uint32_t* pa = (const uint32_t*)(a + r * row);
+		const uint32_t* pb = (const uint32_t*)(b + r * row);
+		for (int px = 0; px < left; px++)
+			if (pa[px] != pb[px]) { left = px; break; }
+		for (int px = w - 1; px > right; px--)
+			if (pa[px] != pb[px]) { right = px; break; }
+	}
+	rect.x = left;
+	rect.y = top;
+	rect.w = right - left + 1;
+	rect.h = bottom - top + 1;
+	return rect;
+}
+
+//IO.GifCompactFrames : every frame is kept as the rectangle that changed since the previous one,
+//as palette indices when the whole gif uses at most 256 colors. Frames are expanded into canvas when shown.
+struct HGifCompactFrames
+{
+	void Build(const unsigned char* data, int w, int h, int frames)
+	{
+		width = w;
+		height = h;
+		size_t frame_bytes = (size_t)w * h * 4;
+		rects.resize(frames);
+		offsets.resize(frames);
+		rects[0].x = rects[0].y = 0;
+		rects[0].w = w;
+		rects[0].h = h;
+		for (int frame = 1; frame < frames; frame++)
+			rects[frame] = GifDirtyRect(data + frame_bytes * (frame - 1), data + frame_bytes * frame, w, h);
+
+		std::unordered_map<uint32_t, unsigned char> indices;
+		for (int frame = 0; frame < frames && indices.size() <= 256; frame++)
+		{
+			const HGifRect& rect = rects[frame];
+			for (int y = rect.y; y < rect.y + rect.h && indices.size() <= 256; y++)
+			{
+				const uint32_t* row = (const uint32_t*)(data + frame_bytes * frame) + (size_t)y * w;
+				for (int x = rect.x; x < rect.x + rect.w; x++)
+				{
+					if (indices.count(row[x]) == 0)
+					{
+						if (indices.size() == 256)
+						{
+							indices[row[x]] = 0;  //257 colors, store rgba
+							break;
+						}
+						unsigned char index = (unsigned char)indices.size();
+						indices[row[x]] = index;
+						palette.push_back(row[x]);
+					}
+				}
+			}
+		}
+		if (indices.size() > 256)
+			palette.clear();
+
+		size_t pixel_size = palette.empty() ? 4 : 1;
+		for (int frame = 0; frame < frames; frame++)
+		{
+			const HGifRect& rect = rects[frame];
+			offsets[frame] = pixels.size();
+			for (int y = rect.y; y < rect.y + rect.h; y++)
+			{
+				const uint32_t* row = (const uint32_t*)(data + frame_bytes * frame) + (size_t)y * w + rect.x;
+				if (pixel_size == 4)
+					pixels.insert(pixels.end(), (const unsigned char*)row, (const unsigned char*)(row + rect.w));
+				else
+					for (int x = 0; x < rect.w; x++)
+						pixels.push_back(indices[row[x]]);
+			}
+		}
+		pixels.shrink_to_fit();
+		canvas.resize(frame_bytes);
+	}
+
+	//Brings canvas to frame, changed being the part that differs from what it held before
+	unsigned char* Seek(int frame, HGifRect& changed)
+	{
+		changed = HGifRect{ 0, 0, 0, 0 };
+		int first = frame > canvas_frame ? canvas_frame + 1 : 0;  //Going back means starting over from frame 0
+		for (int f = first; f <= frame; f++)
+		{
+			Apply(f);
+			changed = Union(changed, rects[f]);
+		}
+		canvas_frame = frame;
+		return canvas.data();
+	}
+
+	size_t MemoryBytes() const
+	{
+		return pixels.size() + palette.size() * 4 + canvas.size() + rects.size() * (sizeof(HGifRect) + sizeof(size_t));
+	}
+
+private:
+	static HGifRect Union(const HGifRect& a, const HGifRect& b)
+	{
+		if (a.w <= 0 || a.h <= 0)
+			return b;
+		if (b.w <= 0 || b.h <= 0)
+			return a;
+		HGifRect rect;
+		rect.x = std::min(a.x, b.x);
+		rect.y = std::min(a.y, b.y);
+		rect.w = std::max(a.x + a.w, b.x + b.w) - rect.x;
+		rect.h = std::max(a.y + a.h, b.y + b.h) - rect.y;
+		return rect;
+	}
+
+	void Apply(int frame)
+	{
+		const HGifRect& rect = rects[frame];
+		const unsigned char* src = pixels.data() + offsets[frame];
+		for (int y = rect.y; y < rect.y + rect.h; y++)
+		{
+			uint32_t* dst = (uint32_t*)canvas.data() + (size_t)y * width + rect.x;
+			if (palette.empty())
+			{
+				memcpy(dst, src, (size_t)rect.w * 4);
+				src += (size_t)rect.w * 4;
+			}
+			else
+			{
+				for (int x = 0; x < rect.w; x++)
+					dst[x] = palette[*src++];
+			}
+		}
+	}
+
+	int width = 0, height = 0;
+	std::vector<HGifRect> rects;
+	std::vector<size_t> offsets;
+	std::vector<uint32_t> palette;      //Empty : pixels are rgba
+	std::vector<unsigned char> pixels;
+	std::vector<unsigned char> canvas;  //rgba of canvas_frame
+	int canvas_frame = -1;
+};
+
+size_t HImageInfo_gif::CacheBytes() const
+{
+	size_t frame_bytes = (size_t)image.width * image.height * 4;
+	if (IsAtlas())
+		return AtlasPageBytes() * AtlasPageCount();
+	if (stream)
+		return frame_bytes + stream->MemoryBytes();
+	if (compact)
+		return frame_bytes + compact->MemoryBytes();
+	return data ? frame_bytes * (frames + 1) : frame_bytes;
+}
+
 struct AsynchronousGIF_info
 {
-	AsynchronousGIF_info(const char*& filename_, HImage** image_out_, float speed_, float life_cycle_, CreateTextureCallback load_, DeleteTextureCallback unload_)
+	AsynchronousGIF_info(const char*& filename_, float speed_, float life_cycle_, CreateTextureCallback load_, DeleteTextureCallback unload_)
 	{
 		filename = filename_;
-		image_out = image_out_;
 		life_cycle = life_cycle_;
 		load = load_;
 		speed = speed_;
 		unload = unload_;
 	}
-	const char* filename;
-	HImage** image_out;
+	std::string filename;
 	float life_cycle;
 	float speed;
 	CreateTextureCallback load = 0;
 	DeleteTextureCallback unload = 0;
+	std::shared_ptr<HLoadRequest> request;
 };
 struct AsynchronousGIF_info_Bit
 {
-	AsynchronousGIF_info_Bit(HBitImage& image_, size_t& size_, HImage** image_out_, float speed_, float life_cycle_, CreateTextureCallback load_, DeleteTextureCallback unload_)
+	AsynchronousGIF_info_Bit(std::shared_ptr<HFileSource> bytes_, float speed_, float life_cycle_, CreateTextureCallback load_, DeleteTextureCallback unload_)
 	{
-		image = &image_;
-		size = &size_;
-		image_out = image_out_;
+		bytes = bytes_;
 		life_cycle = life_cycle_;
 		load = load_;
 		speed = speed_;
 		unload = unload_;
 	}
-	HBitImage* image;
-	size_t* size;
-	HImage** image_out;
+	std::shared_ptr<HFileSource> bytes;  //Copy of the caller's memory, which may be gone before the task runs
 	float life_cycle;
 	float speed;
 	CreateTextureCallback load = 0;
 	DeleteTextureCallback unload = 0;
+	std::shared_ptr<HLoadRequest> request;
 };
 #if HIMAGE_MANAGER_URL_IMAGE_ENABLED
 struct AsynchronousGIF_URL_info
 {
-	AsynchronousGIF_URL_info(const char* id_, const char* url_, const char* path_, bool CacheFile_, HImage** image_out_, float speed_, float life_cycle_, CreateTextureCallback load_, DeleteTextureCallback unload_)
+	AsynchronousGIF_URL_info(const char* id_, const char* url_, const char* path_, bool CacheFile_, float speed_, float life_cycle_, CreateTextureCallback load_, DeleteTextureCallback unload_)
 	{
 		id = id_;
 		url = url_;
 		path = path_;
 		CacheFile = CacheFile_;
-		image_out = image_out_;
 		life_cycle = life_cycle_;
 		load = load_;
 		unload = unload_;
 		speed = speed_;
 	}
-	const char* id;
-	const char* url;
-	const char* path;
+	std::string id;
+	std::string url;
+	std::string path;
 	bool CacheFile;
-	HImage** image_out;
 	float life_cycle;
 	float speed;
 	CreateTextureCallback load;
 	DeleteTextureCallback unload;
+	std::shared_ptr<HLoadRequest> request;
+};
+#endif
+#endif
+
+inline bool HImageFormatIsCompressed(int format)
+{
+	return format == HImageFormat_BC1 || format == HImageFormat_BC3;
+}
+
+//Bytes of a w x h image in format (HTexture::format)
+inline size_t HImageDataSize(int format, int w, int h)
+{
+	size_t pixels = (size_t)w * h;
+	switch (format)
+	{
+	case HImageFormat_R8:
+		return pixels;
+	case HImageFormat_RG8:
+	case HImageFormat_RGB565:
+		return pixels * 2;
+	case HImageFormat_BC1:
+		return (size_t)((w + 3) / 4) * ((h + 3) / 4) * 8;
+	case HImageFormat_BC3:
+		return (size_t)((w + 3) / 4) * ((h + 3) / 4) * 16;
+	default:
+		return pixels * 4;
+	}
+}
+
+enum HImageKind
+{
+	HImageKind_Image,
+	HImageKind_Url,
+	HImageKind_Gif,
+	HImageKind_UrlGif
 };
+
+void ReleaseSharedTexture(uint64_t content_key);
+
+//Finished decode waiting for its texture upload in HImageManager::updata
+struct HDecodedImage
+{
+	uint64_t key = 0;
+	std::string id;
+	int kind = HImageKind_Image;
+	int lod_size = 0;  //IO.DecodeToDisplaySize level, 0 : full resolution
+	HTexture texture = { 0, 0, 0, 0, 0 };
+#if HIMAGE_MANAGER_GIF_IMAGE_ENABLED
+	HImageInfo_gif gif;
+#endif
+	float life_cycle = 1.5;
+	CreateTextureCallback load = 0;
+	DeleteTextureCallback unload = 0;
+	std::shared_ptr<HLoadRequest> request;
+	std::shared_ptr<HFileSource> source;  //Owns texture.texture_data when it comes from IO.DecodedCacheDirectory
+	uint64_t content_key = 0;             //IO.DeduplicateContent : without texture.texture_data, a reference to this shared texture is held instead of pixels
+
+	inline bool IsGif() const
+	{
+		return kind == HImageKind_Gif || kind == HImageKind_UrlGif;
+	}
+
+	size_t UploadBytes() const
+	{
+#if HIMAGE_MANAGER_GIF_IMAGE_ENABLED
+		if (IsGif())
+			return (gif.data || gif.stream || gif.compact) ? (gif.IsAtlas() ? gif.AtlasPageBytes() * gif.AtlasPageCount() : (size_t)gif.image.width * gif.image.height * 4) : 0;
 #endif
+		return texture.texture_data ? HImageDataSize(texture.format, texture.width, texture.height) : 0;
+	}
+
+	void Release()
+	{
+#if HIMAGE_MANAGER_GIF_IMAGE_ENABLED
+		stbi_image_free(gif.data);
+		stbi_image_free(gif.delays);
+		gif.data = 0;
+		gif.delays = 0;
+		gif.stream.reset();
+		gif.compact.reset();
 #endif
+		if (content_key && !texture.texture_data)
+			ReleaseSharedTexture(content_key);
+		content_key = 0;
+		if (source)
+			source.reset();
+		else
+			stbi_image_free(texture.texture_data);
+		texture.texture_data = 0;
+	}
+};
 HImageManagerIO IO;
 
-std::unordered_map<std::string, HImageInfo> hashMap;
-#if HIMAGE_MANAGER_URL_IMAGE_ENABLED
-std::unordered_map<std::string, HImageInfo> url_hashMap;
-std::unordered_map<std::string, HTexture> Asyn_url_waitingloader_lists;
-#if _HAS_CXX17
-#include <filesystem>
-#endif // _HAS_CXX17
-#endif
-#if HIMAGE_MANAGER_GIF_IMAGE_ENABLED
-std::unordered_map<std::string, HImageInfo_gif> gif_hashMap;
-#if HIMAGE_MANAGER_URL_IMAGE_ENABLED
-std::unordered_map<std::string, HImageInfo_gif> gif_url_hashMap;
-#endif
-#endif
-#if HIMAGE_MANAGER_GIF_IMAGE_ENABLED || HIMAGE_MANAGER_URL_IMAGE_ENABLED
-std::vector<std::string> Asynchronouslist;
-#endif
-std::vector<HTextureID> StaticImages;
+//IO.DeduplicateContent : texture of every static entry decoded from the same bytes with the same settings
+struct HSharedTexture
+{
+	HImage image;
+	int format = 0;
+	DeleteTextureCallback unload = 0;
+	size_t bytes = 0;
+	int refs = 0;  //Cache entries, and decoded images waiting for their upload
+};
+std::mutex SharedTextureMutex;  //Workers look textures up and take references, only the UI thread creates and deletes them
+std::unordered_map<uint64_t, HSharedTexture, HImageKeyHash> SharedTextures;
+
+//fmt for rgba data (gif frames)
+inline int RgbaUploadFormat(int channel)
+{
+	return IO.UploadFormats ? HImageFormat_RGBA8 : channel;
+}
+
+//Lock-free multi-producer / single-consumer hand-off of finished decodes.
+//Workers push onto an intrusive stack, the UI thread takes the whole stack at once and reverses it back into arrival order.
+class HCompletionQueue
+{
+public:
+	~HCompletionQueue()
+	{
+		Node* node = head.exchange(0);
+		while (node)
+		{
+			Node* next = node->next;
+			node->decoded.Release();
+			delete node;
+			node = next;
+		}
+	}
+
+	void Push(const HDecodedImage& decoded)
+	{
+		Node* node = new Node;
+		node->decoded = decoded;
+		node->next = head.load(std::memory_order_relaxed);
+		while (!head.compare_exchange_weak(node->next, node, std::memory_order_release, std::memory_order_relaxed))
+			;
+	}
+
+	//UI thread only
+	template<typename Func>
+	void Drain(Func func)
+	{
+		Node* node = head.exchange(0, std::memory_order_acquire);
+		Node* ordered = 0;
+		while (node)
+		{
+			Node* next = node->next;
+			node->next = ordered;
+			ordered = node;
+			node = next;
+		}
+		while (ordered)
+		{
+			Node* next = ordered->next;
+			func(ordered->decoded);
+			delete ordered;
+			ordered = next;
+		}
+	}
+
+private:
+	struct Node
+	{
+		HDecodedImage decoded;
+		Node* next = 0;
+	};
+
+	std::atomic<Node*> head{ 0 };
+};
+
+//Shared worker pool for asynchronous loads. Each worker owns a queue and steals from the others when its own runs dry.
+//Both take the highest priority task they can see, cancelled ones are dropped on the way.
+class HImageThreadPool
+{
+public:
+	struct Task
+	{
+		std::function<void()> run;
+		std::shared_ptr<HLoadRequest> request;
+
+		inline int Priority() const { return request ? request->priority.load() : 0; }
+		inline bool Cancelled() const { return request && request->cancelled; }
+	};
+
+	~HImageThreadPool()
+	{
+		Shutdown();
+	}
+
+	void Submit(std::function<void()> run, std::shared_ptr<HLoadRequest> request = 0)
+	{
+		if (workers.empty())
+			Start();
+
+		Worker& worker = *workers[next_worker++ % workers.size()];  //Also called by the workers, resuming parked url loads
+		{
+			std::lock_guard<std::mutex> lock(worker.mutex);
+			Task task;
+			task.run = std::move(run);
+			task.request = std::move(request);
+			worker.tasks.push_back(std::move(task));
+		}
+		queued++;
+		{
+			std::lock_guard<std::mutex> lock(sleep_mutex);
+		}
+		sleep_cv.notify_one();
+	}
+
+	void Shutdown()
+	{
+		{
+			std::lock_guard<std::mutex> lock(sleep_mutex);
+			stopping = true;
+		}
+		sleep_cv.notify_all();
+		for (size_t i = 0; i < workers.size(); i++)
+		{
+			if (workers[i]->thread.joinable())
+				workers[i]->thread.join();
+		}
+		workers.clear();
+		queued = 0;
+		stopping = false;
+	}
+
+	HImageThreadPoolStats GetStats()
+	{
+		HImageThreadPoolStats stats;
+		stats.Workers = (int)workers.size();
+		stats.BusyWorkers = busy;
+		stats.QueueDepth = std::max(0, (int)queued);
+		stats.TimedOutTasks = timed_out;
+		stats.CancelledTasks = cancelled;
+		return stats;
+	}
+
+	//Cooperative time limit : long running tasks poll this at their checkpoints and give up once it is true
+	static bool TaskExpired()
+	{
+		return std::chrono::steady_clock::now() > TaskDeadline();
+	}
+
+private:
+	struct Worker
+	{
+		std::deque<Task> tasks;
+		std::mutex mutex;
+		std::thread thread;
+	};
+
+	static std::chrono::steady_clock::time_point& TaskDeadline()
+	{
+		static thread_local std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+		return deadline;
+	}
+
+	void Start()
+	{
+		int count = IO.ThreadPoolMaximumNuberOfThreads;
+		if (count <= 0)
+			count = (int)std::thread::hardware_concurrency();
+		if (count <= 0)
+			count = 1;
+
+		for (int i = 0; i < count; i++)
+			workers.push_back(std::unique_ptr<Worker>(new Worker()));
+		for (int i = 0; i < count; i++)
+			workers[i]->thread = std::thread(&HImageThreadPool::WorkerMain, this, (size_t)i);
+	}
+
+	bool Pop(size_t index, Task& task)
+	{
+		//Own queue first, then steal from the others. Ties go to the oldest task
+		for (size_t i = 0; i < workers.size(); i++)
+		{
+			Worker& worker = *workers[(index + i) % workers.size()];
+			std::lock_guard<std::mutex> lock(worker.mutex);
+			int best = -1;
+			int best_priority = 0;
+			for (size_t t = 0; t < worker.tasks.size();)
+			{
+				if (worker.tasks[t].Cancelled())
+				{
+					worker.tasks.erase(worker.tasks.begin() + t);
+					queued--;
+					cancelled++;
+					continue;
+				}
+				int priority = worker.tasks[t].Priority();
+				if (best < 0 || priority > best_priority)
+				{
+					best = (int)t;
+					best_priority = priority;
+				}
+				t++;
+			}
+			if (best < 0)
+				continue;
+			task = std::move(worker.tasks[best]);
+			worker.tasks.erase(worker.tasks.begin() + best);
+			queued--;
+			return true;
+		}
+		return false;
+	}
+
+	void WorkerMain(size_t index)
+	{
+		while (!stopping)
+		{
+			Task task;
+			if (!Pop(index, task))
+			{
+				std::unique_lock<std::mutex> lock(sleep_mutex);
+				sleep_cv.wait(lock, [this] { return stopping || queued > 0; });
+				continue;
+			}
+
+			busy++;
+			int limit = IO.MaximumThreadExecutionTime_Seconds;
+			TaskDeadline() = limit > 0 ? std::chrono::steady_clock::now() + std::chrono::seconds(limit) : std::chrono::steady_clock::time_point::max();
+			task.run();
+			if (TaskExpired())
+				timed_out++;
+			TaskDeadline() = std::chrono::steady_clock::time_point::max();
+			busy--;
+		}
+	}
+
+	std::vector<std::unique_ptr<Worker>> workers;
+	std::mutex sleep_mutex;
+	std::condition_variable sleep_cv;
+	std::atomic<int> queued{ 0 };
+	std::atomic<int> busy{ 0 };
+	std::atomic<int> timed_out{ 0 };
+	std::atomic<int> cancelled{ 0 };
+	std::atomic<bool> stopping{ false };
+	std::atomic<size_t> next_worker{ 0 };
+};
+
+//Cache records in fixed pages that never move, so HImage pointers stay valid until their entry is erased and scans read the records back to back.
+//Erasing a slot bumps its generation, an HImageRef to it then turns stale. A slot whose generations are used up is retired, never reused. Offers the unordered_map subset the cache uses, slots have first (key) and second (record) like map nodes
+template<typename T>
+class HImageSlotMap
+{
+public:
+	struct Slot
+	{
+		uint64_t first = 0;
+		T second;
+		uint32_t generation = 1;
+		bool used = false;
+	};
+
+	class iterator
+	{
+	public:
+		iterator(HImageSlotMap* map_, uint32_t slot_) : map(map_), slot(slot_) { Skip(); }
+		Slot& operator*() const { return map->SlotAt(slot); }
+		Slot* operator->() const { return &map->SlotAt(slot); }
+		iterator& operator++() { slot++; Skip(); return *this; }
+		bool operator==(const iterator& other) const { return slot == other.slot; }
+		bool operator!=(const iterator& other) const { return slot != other.slot; }
+
+	private:
+		friend class HImageSlotMap;
+		void Skip()
+		{
+			while (slot < map->slot_count && !map->SlotAt(slot).used)
+				slot++;
+		}
+
+		HImageSlotMap* map;
+		uint32_t slot;
+	};
+
+	iterator begin() { return iterator(this, 0); }
+	iterator end() { return iterator(this, slot_count); }
+	bool empty() const { return keys.empty(); }
+	size_t size() const { return keys.size(); }
+	size_t count(uint64_t key) const { return keys.count(key); }
+
+	iterator find(uint64_t key)
+	{
+		auto found = keys.find(key);
+		return found == keys.end() ? end() : iterator(this, found->second);
+	}
+
+	T& operator[](uint64_t key)
+	{
+		auto found = keys.find(key);
+		if (found != keys.end())
+			return SlotAt(found->second).second;
+		uint32_t index;
+		if (!free_slots.empty())
+		{
+			index = free_slots.back();
+			free_slots.pop_back();
+		}
+		else
+		{
+			IM_ASSERT(slot_count < IndexMask);
+			index = slot_count++;
+			if (index % PageSize == 0)
+				pages.emplace_back(new Slot[PageSize]);
+		}
+		Slot& slot = SlotAt(index);
+		slot.first = key;
+		slot.used = true;
+		keys[key] = index;
+		return slot.second;
+	}
+
+	void erase(iterator iter)
+	{
+		Slot& slot = *iter;
+		keys.erase(slot.first);
+		slot.second = T();
+		slot.used = false;
+		if (slot.generation == GenerationMax)
+			return;  //Retired : the next generation would wrap around to the one of refs handed out before
+		slot.generation++;
+		free_slots.push_back(iter.slot);
+	}
+
+	HImageRef Ref(uint64_t key) const
+	{
+		HImageRef ref;
+		auto found = keys.find(key);
+		if (found != keys.end())
+			ref.id = (SlotAt(found->second).generation << IndexBits) | (found->second + 1);
+		return ref;
+	}
+
+	T* Find(HImageRef ref)
+	{
+		uint32_t index = (ref.id & IndexMask) - 1;
+		if (!ref.id || index >= slot_count)
+			return 0;
+		Slot& slot = SlotAt(index);
+		return slot.used && slot.generation == ref.id >> IndexBits ? &slot.second : 0;
+	}
+
+private:
+	static const uint32_t PageSize = 64;
+	static const uint32_t IndexBits = 20;  //Slot + 1, the rest of the id is the generation
+	static const uint32_t IndexMask = (1u << IndexBits) - 1;
+	static const uint32_t GenerationMax = (1u << (32 - IndexBits)) - 1;
+
+	Slot& SlotAt(uint32_t index) const { return pages[index / PageSize][index % PageSize]; }
+
+	std::vector<std::unique_ptr<Slot[]>> pages;
+	std::unordered_map<uint64_t, uint32_t, HImageKeyHash> keys;
+	std::vector<uint32_t> free_slots;
+	uint32_t slot_count = 0;
+};
+
+HImageSlotMap<HImageInfo> hashMap;
+#if HIMAGE_MANAGER_URL_IMAGE_ENABLED
+HImageSlotMap<HImageInfo> url_hashMap;
+#if _HAS_CXX17
+#include <filesystem>
+#endif // _HAS_CXX17
+#endif
+#if HIMAGE_MANAGER_GIF_IMAGE_ENABLED
+HImageSlotMap<HImageInfo_gif> gif_hashMap;
+#if HIMAGE_MANAGER_URL_IMAGE_ENABLED
+HImageSlotMap<HImageInfo_gif> gif_url_hashMap;
+#endif
+#endif
+std::unordered_map<uint64_t, std::shared_ptr<HLoadRequest>, HImageKeyHash> Asynchronouslist;  //UI thread only
+std::unordered_map<uint64_t, std::string, HImageKeyHash> HandleNames;  //File names behind the handles, needed when a handle misses the cache
+HCompletionQueue Asyn_decoded_lists;            //Filled by the workers, emptied by HImageManager::updata. The cache maps are only touched by the UI thread
+std::deque<HDecodedImage> UploadQueue;          //UI thread only
+size_t UploadQueueBytes = 0;
+HImageUploadQueueStats UploadStats;
+
+struct HPackedImage
+{
+	const unsigned char* data = 0;
+	size_t size = 0;
+	const char* name = 0;
+	size_t name_length = 0;
+	int width = 0, height = 0, channel = 0;
+	bool gif = false;
+	std::shared_ptr<HFileSource> file;  //Keeps a mapped pack alive while its image decodes
+};
+
+//Read by the workers, so guarded by ImagePackMutex
+std::mutex ImagePackMutex;
+std::unordered_map<uint64_t, HPackedImage, HImageKeyHash> PackedImages;
+
+#if HIMAGE_MANAGER_URL_IMAGE_ENABLED
+void SetClientTimeout(httplib::Client& client)
+{
+	if (IO.MaximumThreadExecutionTime_Seconds > 0)
+	{
+		client.set_connection_timeout(IO.MaximumThreadExecutionTime_Seconds);
+		client.set_read_timeout(IO.MaximumThreadExecutionTime_Seconds);
+	}
+}
+
+//Keep-alive clients per scheme://host:port shared by the url workers. Loads of a host beyond IO.UrlMaxConnectionsPerHost are parked
+//on the host without holding a worker, and submitted again once one of its connections is free, which they then reuse without connecting (and handshaking) again
+class HUrlClientPool
+{
+public:
+	//0 when the host is at IO.UrlMaxConnectionsPerHost : retry is then parked until Resume hands it back
+	std::unique_ptr<httplib::Client> Acquire(const std::string& host, HImageThreadPool::Task retry)
+	{
+		std::unique_ptr<httplib::Client> client;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			HHost& entry = hosts[host];
+			if (IO.UrlMaxConnectionsPerHost > 0 && entry.idle.empty() && entry.open >= IO.UrlMaxConnectionsPerHost)
+			{
+				entry.parked.push_back(std::move(retry));
+				stats.ParkedLoads++;
+				return client;
+			}
+			if (IO.UrlMaxConnectionsPerHost > 0 && !entry.idle.empty())
+			{
+				client = std::move(entry.idle.back());
+				entry.idle.pop_back();
+				stats.ConnectionsReused++;
+			}
+			else
+			{
+				entry.open++;
+				stats.Connections++;
+				stats.ConnectionsOpened++;
+				stats.PeakConnectionsPerHost = std::max(stats.PeakConnectionsPerHost, entry.open);
+			}
+		}
+		if (!client)
+		{
+			client.reset(new httplib::Client(host));
+			client->set_keep_alive(IO.UrlMaxConnectionsPerHost > 0);
+		}
+		SetClientTimeout(*client);
+		return client;
+	}
+
+	//reuse false : the request failed, the connection is closed rather than kept
+	void Release(const std::string& host, std::unique_ptr<httplib::Client> client, bool reuse)
+	{
+		std::unique_ptr<httplib::Client> closing;
+		std::lock_guard<std::mutex> lock(mutex);
+		HHost& entry = hosts[host];
+		if (reuse && IO.UrlMaxConnectionsPerHost > 0)
+			entry.idle.push_back(std::move(client));
+		else
+		{
+			entry.open--;
+			stats.Connections--;
+			closing = std::move(client);
+		}
+	}
+
+	//Parked loads of the hosts with a free connection, to be submitted again. Loads cancelled while parked are dropped
+	void Resume(std::vector<std::pair<std::string, HImageThreadPool::Task>>& resumed)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for (auto& host : hosts)
+		{
+			HHost& entry = host.second;
+			int free = IO.UrlMaxConnectionsPerHost > 0 ? IO.UrlMaxConnectionsPerHost - entry.open + (int)entry.idle.size() : (int)entry.parked.size();
+			while (!entry.parked.empty() && entry.resumed < free)
+			{
+				HImageThreadPool::Task task = std::move(entry.parked.front());
+				entry.parked.pop_front();
+				stats.ParkedLoads--;
+				if (task.Cancelled())
+					continue;
+				entry.resumed++;
+				resumed.push_back(std::make_pair(host.first, std::move(task)));
+			}
+		}
+	}
+
+	//A resumed load ran or was dropped from the queue
+	void Resumed(const std::string& host)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		hosts[host].resumed--;
+	}
+
+	HImageUrlPoolStats GetStats()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return stats;
+	}
+
+	//Idle connections and parked loads, the workers must be stopped
+	void Clear()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for (auto& host : hosts)
+			for (auto& client : host.second.idle)
+				client->stop();
+		hosts.clear();
+		stats.Connections = 0;
+		stats.ParkedLoads = 0;
+	}
+
+private:
+	struct HHost
+	{
+		std::vector<std::unique_ptr<httplib::Client>> idle;
+		int open = 0;     //Idle and in use
+		int resumed = 0;  //Handed back by Resume, not yet run or dropped
+		std::deque<HImageThreadPool::Task> parked;
+	};
+
+	std::mutex mutex;
+	std::unordered_map<std::string, HHost> hosts;
+	HImageUrlPoolStats stats;
+};
+HUrlClientPool UrlClients;
+
+void CloseUrlConnections()
+{
+	UrlClients.Clear();
+}
+#endif // HIMAGE_MANAGER_URL_IMAGE_ENABLED
+
+//Defined after everything the workers use, so it is destroyed (joining them) first
+HImageThreadPool ThreadPool;
+std::vector<HTextureID> StaticImages;
+std::list<HCacheRef> CacheOrder;  //LRU : least recently used first. Clock : the ring the hand walks over
+std::list<HCacheRef>::iterator ClockHand = CacheOrder.end();
+size_t CacheBytes = 0;
+
+//Expiry deadlines, earliest first. Hits do not touch the heap : a popped deadline that was pushed back by a later hit is re-armed instead
+struct HExpiry
+{
+	double time;
+	unsigned int serial;  //Stale once the entry was evicted, even if the same key got cached again
+	HCacheRef ref;
+
+	inline bool operator>(const HExpiry& other) const { return time > other.time; }
+};
+std::priority_queue<HExpiry, std::vector<HExpiry>, std::greater<HExpiry>> ExpiryHeap;
+double CacheTime = 0;  //Sum of the delta_time passed to HImageManager::updata
+unsigned int ExpirySerial = 0;
+
+HImageManagerIO& HImageManager::GetIO()
+{
+	return IO;
+}
+
+HImageThreadPoolStats HImageManagerIO::GetThreadPoolStats()
+{
+	return ThreadPool.GetStats();
+}
+
+HImageUploadQueueStats HImageManagerIO::GetUploadQueueStats()
+{
+	return UploadStats;
+}
+#if HIMAGE_MANAGER_URL_IMAGE_ENABLED
+
+HImageUrlPoolStats HImageManagerIO::GetUrlPoolStats()
+{
+	return UrlClients.GetStats();
+}
+
+//Counts a resumed load against its host until it runs or is dropped, so the same free connection is not handed to several parked loads
+struct HUrlResumeGuard
+{
+	std::string host;
+	bool ran = false;
+
+	~HUrlResumeGuard()
+	{
+		if (!ran)
+			UrlClients.Resumed(host);
+	}
+
+	void Run()
+	{
+		ran = true;
+		UrlClients.Resumed(host);
+	}
+};
+
+//Called when a connection is released, and every updata in case a resumed load was cancelled before it ran
+void ResumeParkedUrlLoads()
+{
+	std::vector<std::pair<std::string, HImageThreadPool::Task>> resumed;
+	UrlClients.Resume(resumed);
+	for (auto& load : resumed)
+	{
+		std::shared_ptr<HUrlResumeGuard> guard = std::make_shared<HUrlResumeGuard>();
+		guard->host = load.first;
+		std::function<void()> run = std::move(load.second.run);
+		ThreadPool.Submit([guard, run]() { guard->Run(); run(); }, std::move(load.second.request));
+	}
+}
+
+//0 when the load was parked : run is submitted again once the host has a free connection
+std::unique_ptr<httplib::Client> AcquireUrlClient(const std::string& url, std::function<void()> run, std::shared_ptr<HLoadRequest> request)
+{
+	HImageThreadPool::Task retry;
+	retry.run = std::move(run);
+	retry.request = std::move(request);
+	return UrlClients.Acquire(url, std::move(retry));
+}
+
+void ReleaseUrlClient(const std::string& url, std::unique_ptr<httplib::Client> client, bool reuse)
+{
+	UrlClients.Release(url, std::move(client), reuse);
+	ResumeParkedUrlLoads();
+}
+#endif
+
+size_t HImageManagerIO::GetCacheBytes()
+{
+	return CacheBytes;
+}
+
+//IO.SmallImageAtlasMaxSide : small static images are placed on the shelves of shared pages with a one pixel border repeating their edge
+struct HAtlasShelf
+{
+	int y, height;
+	int x;  //Where the next image goes
+};
+
+struct HAtlasSlot
+{
+	unsigned int id;
+	HCacheRef ref;    //Set once the image is stored in its map
+	int shelf;
+	int x, y, w, h;   //Including the border
+};
+
+HImageInfo* FindCacheEntry(const HCacheRef& ref);
+
+struct HImageAtlasPage
+{
+	HTextureID texture = 0;
+	int size = 0;
+	std::vector<unsigned char> pixels;  //Copy of the texture, repacking moves the images inside it
+	std::vector<HAtlasShelf> shelves;
+	std::vector<HAtlasSlot> slots;
+	int bottom = 0;
+	size_t live_area = 0;
+	size_t freed_area = 0;  //Released since the page was last packed
+	size_t failed_repack_area = 0;  //freed_area when a repack last failed, the next one waits until more is freed
+	bool repack_wanted = false;     //Done by HImageManager::updata, never under draw commands already recorded with the old uv
+
+	inline size_t Bytes() const { return (size_t)size * size * 4 * 2; }  //Texture and pixels
+
+	//Worth repacking for a w x h image : enough freed space and more of it than when the last repack failed
+	bool ShouldRepack(int w, int h) const
+	{
+		return freed_area > failed_repack_area && freed_area >= (size_t)w * h && live_area * 2 <= (size_t)size * size;
+	}
+
+	//Best fitting shelf, or a new one when the best would waste more than half the image height
+	bool Allocate(int w, int h, int& shelf_out, int& x, int& y)
+	{
+		int best = -1;
+		for (int i = 0; i < (int)shelves.size(); i++)
+		{
+			if (shelves[i].height < h || shelves[i].x + w > size || (best >= 0 && shelves[best].height <= shelves[i].height))
+				continue;
+			best = i;
+		}
+		if ((best < 0 || shelves[best].height > h + h / 2) && bottom + h <= size && w <= size)
+		{
+			HAtlasShelf shelf = { bottom, h, 0 };
+			shelves.push_back(shelf);
+			bottom += h;
+			best = (int)shelves.size() - 1;
+		}
+		if (best < 0)
+			return false;
+		shelf_out = best;
+		x = shelves[best].x;
+		y = shelves[best].y;
+		shelves[best].x += w;
+		return true;
+	}
+
+	void SetUV(HImage& image, const HAtlasSlot& slot) const
+	{
+		image.uv_min = ImVec2((slot.x + 1) / (float)size, (slot.y + 1) / (float)size);
+		image.uv_max = ImVec2((slot.x + slot.w - 1) / (float)size, (slot.y + slot.h - 1) / (float)size);
+	}
+
+	//Packs the remaining images again, tallest first, and moves their uv. Nothing changes if they do not fit
+	bool Repack()
+	{
+		std::vector<HAtlasShelf> old_shelves;
+		old_shelves.swap(shelves);
+		int old_bottom = bottom;
+		bottom = 0;
+		std::sort(slots.begin(), slots.end(), [](const HAtlasSlot& a, const HAtlasSlot& b) { return a.h > b.h; });
+		std::vector<HAtlasSlot> packed = slots;
+		for (HAtlasSlot& slot : packed)
+		{
+			if (!Allocate(slot.w, slot.h, slot.shelf, slot.x, slot.y))
+			{
+				shelves.swap(old_shelves);
+				bottom = old_bottom;
+				failed_repack_area = freed_area;
+				return false;
+			}
+		}
+		std::vector<unsigned char> old_pixels = pixels;
+		for (size_t i = 0; i < packed.size(); i++)
+		{
+			const HAtlasSlot& from = slots[i];
+			const HAtlasSlot& to = packed[i];
+			for (int row = 0; row < to.h; row++)
+				memcpy(pixels.data() + ((size_t)(to.y + row) * size + to.x) * 4, old_pixels.data() + ((size_t)(from.y + row) * size + from.x) * 4, (size_t)to.w * 4);
+			if (HImageInfo* info = FindCacheEntry(to.ref))
+				SetUV(info->image, to);
+		}
+		slots.swap(packed);
+		freed_area = 0;
+		failed_repack_area = 0;
+		IO.UpdateTexture(texture, pixels.data(), size, size, RgbaUploadFormat(4), 0, 0, size, size);
+		return true;
+	}
+};
+
+std::vector<std::unique_ptr<HImageAtlasPage>> AtlasPages;  //0 once freed, the index is reused by the next page
+unsigned int AtlasSlotSerial = 0;
+
+//Copies t into an atlas page and points info at it. false : the image needs its own texture
+bool AddToAtlas(HImageInfo& info, const HTexture& t, CreateTextureCallback create)
+{
+	int max_side = IO.SmallImageAtlasMaxSide;
+	if (max_side <= 0 || !IO.UpdateTexture || create != IO.CreateTexture || t.width > max_side || t.height > max_side
+		|| !(t.format <= 4 || t.format == HImageFormat_RGBA8))
+		return false;
+
+	int w = t.width + 2, h = t.height + 2;
+	int page_index = -1, shelf = 0, x = 0, y = 0;
+	int pages = 0, free_index = -1;
+	for (int i = 0; i < (int)AtlasPages.size(); i++)
+	{
+		if (!AtlasPages[i])
+		{
+			if (free_index < 0)
+				free_index = i;
+			continue;
+		}
+		pages++;
+		HImageAtlasPage& page = *AtlasPages[i];
+		if (page_index >= 0)
+			continue;
+		if (page.Allocate(w, h, shelf, x, y))
+			page_index = i;
+		else if (page.ShouldRepack(w, h))
+			page.repack_wanted = true;
+	}
+	if (page_index < 0)
+	{
+		if (pages >= IO.SmallImageAtlasMaxPages)
+			return false;
+		std::unique_ptr<HImageAtlasPage> page(new HImageAtlasPage());
+		page->size = IO.SmallImageAtlasSize;
+		if (!page->Allocate(w, h, shelf, x, y))
+			return false;
+		page->pixels.assign((size_t)page->size * page->size * 4, 0);
+		page->texture = IO.CreateTexture(page->pixels.data(), page->size, page->size, RgbaUploadFormat(4));
+		if (!page->texture)
+			return false;
+		CacheBytes += page->Bytes();
+		if (free_index >= 0)
+		{
+			AtlasPages[free_index] = std::move(page);
+			page_index = free_index;
+		}
+		else
+		{
+			AtlasPages.push_back(std::move(page));
+			page_index = (int)AtlasPages.size() - 1;
+		}
+	}
+
+	HImageAtlasPage& page = *AtlasPages[page_index];
+	for (int row = 0; row < h; row++)
+	{
+		const unsigned char* src = t.texture_data + (size_t)std::min(std::max(row - 1, 0), t.height - 1) * t.width * 4;
+		unsigned char* dst = page.pixels.data() + ((size_t)(y + row) * page.size + x) * 4;
+		memcpy(dst + 4, src, (size_t)t.width * 4);
+		memcpy(dst, src, 4);
+		memcpy(dst + (size_t)(w - 1) * 4, src + (size_t)(t.width - 1) * 4, 4);
+	}
+	IO.UpdateTexture(page.texture, page.pixels.data(), page.size, page.size, RgbaUploadFormat(4), x, y, w, h);
+
+	HAtlasSlot slot = { ++AtlasSlotSerial, { -1, 0 }, shelf, x, y, w, h };
+	page.slots.push_back(slot);
+	page.live_area += (size_t)w * h;
+	page.SetUV(info.image, slot);
+	info.image.texture = page.texture;
+	info.atlas_page = page_index;
+	info.atlas_slot = slot.id;
+	return true;
+}
+
+HAtlasSlot* FindAtlasSlot(const HImageInfo& info)
+{
+	for (HAtlasSlot& slot : AtlasPages[info.atlas_page]->slots)
+		if (slot.id == info.atlas_slot)
+			return &slot;
+	return 0;
+}
+
+//The space goes back to its shelf when the image was the last one on it, the rest waits for a repack. An emptied page is freed
+void RemoveFromAtlas(HImageInfo& info)
+{
+	std::unique_ptr<HImageAtlasPage>& owner = AtlasPages[info.atlas_page];
+	HImageAtlasPage& page = *owner;
+	for (size_t i = 0; i < page.slots.size(); i++)
+	{
+		const HAtlasSlot& slot = page.slots[i];
+		if (slot.id != info.atlas_slot)
+			continue;
+		HAtlasShelf& shelf = page.shelves[slot.shelf];
+		if (slot.x + slot.w == shelf.x)
+			shelf.x = slot.x;
+		page.live_area -= (size_t)slot.w * slot.h;
+		page.freed_area += (size_t)slot.w * slot.h;
+		page.slots.erase(page.slots.begin() + i);
+		break;
+	}
+	if (page.slots.empty())
+	{
+		IO.DeleteTexture(page.texture);
+		CacheBytes -= page.Bytes();
+		owner.reset();
+	}
+	info.atlas_page = -1;
+	info.image.texture = 0;
+}
+
+void RepackAtlasPages()
+{
+	for (auto& page : AtlasPages)
+	{
+		if (page && page->repack_wanted)
+		{
+			page->repack_wanted = false;
+			page->Repack();
+		}
+	}
+}
+
+//Takes a reference for a decode that can skip its pixels, t gets the size and format of the shared texture
+bool AcquireSharedTexture(uint64_t content_key, HTexture& t)
+{
+	std::lock_guard<std::mutex> lock(SharedTextureMutex);
+	auto found = SharedTextures.find(content_key);
+	if (found == SharedTextures.end())
+		return false;
+	found->second.refs++;
+	t.width = found->second.image.width;
+	t.height = found->second.image.height;
+	t.channel = found->second.image.channel;
+	t.format = found->second.format;
+	return true;
+}
+
+void ReleaseSharedTexture(uint64_t content_key)
+{
+	HSharedTexture shared;
+	{
+		std::lock_guard<std::mutex> lock(SharedTextureMutex);
+		auto found = SharedTextures.find(content_key);
+		if (found == SharedTextures.end() || --found->second.refs > 0)
+			return;
+		shared = found->second;
+		SharedTextures.erase(found);
+	}
+	if (shared.unload)
+		shared.unload(shared.image.texture);
+	else
+		IO.DeleteTexture(shared.image.texture);
+	CacheBytes -= shared.bytes;
+}
+
+//Called once an entry is stored in its map. bytes 0 : the size of its texture (a shared texture or an atlas page is counted once, by itself)
+void InsertCacheEntry(int kind, uint64_t key, HImageInfo& info, size_t bytes = 0)
+{
+	HCacheRef ref = { kind, key };
+	info.bytes = bytes ? bytes : (info.content_key || info.atlas_page >= 0) ? 0 : HImageDataSize(info.format, info.image.width, info.image.height);
+	info.last_used_frame = ImGui::GetFrameCount();
+	info.referenced = true;
+	info.order = CacheOrder.insert(CacheOrder.end(), ref);
+	CacheBytes += info.bytes;
+	if (info.atlas_page >= 0)
+		if (HAtlasSlot* slot = FindAtlasSlot(info))
+			slot->ref = ref;
+
+	info.last_used_time = CacheTime;
+	info.expiry_serial = ++ExpirySerial;
+	HExpiry expiry = { CacheTime + info.life_cycle, info.expiry_serial, ref };
+	ExpiryHeap.push(expiry);
+}
+
+void TouchCacheEntry(HImageInfo& info, float life_cycle)
+{
+	if (info.life_cycle != life_cycle)
+		info.life_cycle = life_cycle;
+	info.last_used_time = CacheTime;
+	info.last_used_frame = ImGui::GetFrameCount();
+	if (IO.EvictionPolicy == HImageEvictionPolicy_LRU)
+		CacheOrder.splice(CacheOrder.end(), CacheOrder, info.order);
+	else
+		info.referenced = true;
+}
+
+//Deletes the texture and forgets the entry, the caller erases it from its map
+void ReleaseCacheEntry(HImageInfo& info)
+{
+	if (info.content_key)
+		ReleaseSharedTexture(info.content_key);
+	else if (info.atlas_page >= 0)
+		RemoveFromAtlas(info);
+	else if (info.image.texture)
+	{
+		if (info.unload)
+			info.unload(info.image.texture);
+		else
+			IO.DeleteTexture(info.image.texture);
+	}
+	if (ClockHand == info.order)
+		++ClockHand;
+	CacheOrder.erase(info.order);
+	CacheBytes -= info.bytes;
+}
+
+void FailPreloadWaiters();
+
+void HImageManager::Shutdown()
+{
+	for (auto& request : Asynchronouslist)
+		request.second->cancelled = true;
+	ThreadPool.Shutdown();
+#if HIMAGE_MANAGER_URL_IMAGE_ENABLED
+	CloseUrlConnections();
+#endif
+	Asynchronouslist.clear();
+	BitImageKeys.clear();
+	for (auto& decoded : UploadQueue)
+		decoded.Release();
+	UploadQueue.clear();
+	UploadQueueBytes = 0;
+	Asyn_decoded_lists.Drain([](HDecodedImage& decoded) { decoded.Release(); });
+	FailPreloadWaiters();
+}
+
+//Returns true when a load for id is already queued or running, and marks it as asked for this frame
+bool TouchLoadRequest(uint64_t key)
+{
+	auto request = Asynchronouslist.find(key);
+	if (request == Asynchronouslist.end())
+		return false;
+	request->second->priority = ImGui::GetFrameCount();
+	return true;
+}
+
+std::shared_ptr<HLoadRequest> AddLoadRequest(uint64_t key, const std::string& id)
+{
+	std::shared_ptr<HLoadRequest> request = std::make_shared<HLoadRequest>();
+	request->key = key;
+	request->id = id;
+	request->priority = ImGui::GetFrameCount();
+	Asynchronouslist[key] = request;
+	return request;
+}
+
+void CancelForgottenLoadRequests()
+{
+	if (IO.LoadRequestCancelFrames <= 0)
+		return;
+	int frame = ImGui::GetFrameCount();
+	auto iter = Asynchronouslist.begin();
+	while (iter != Asynchronouslist.end())
+	{
+		if (!iter->second->preload && frame - iter->second->priority > IO.LoadRequestCancelFrames)
+		{
+			iter->second->cancelled = true;
+			iter = Asynchronouslist.erase(iter);
+		}
+		else
+			++iter;
+	}
+}
+
+const char* HandleName(uint64_t key)
+{
+	auto name = HandleNames.find(key);
+	return name == HandleNames.end() ? 0 : name->second.c_str();
+}
+
+//A task past IO.MaximumThreadExecutionTime_Seconds hands in an empty image, it is cached as a failed load
+void PushDecodedImage(HDecodedImage& decoded)
+{
+	if (HImageThreadPool::TaskExpired())
+		decoded.Release();
+	Asyn_decoded_lists.Push(decoded);
+}
+
+void DrawLoadingImage(ImDrawList* draw_list, const ImVec2& p_min, const ImVec2& p_max, float rounding, HImageManagerIO::DrawLoadingCallback draw_loading)
+{
+	ImVec2 size = ImRect(p_min, p_max).GetSize();
+	draw_list->AddRectFilled(p_min, p_max, ImGui::GetColorU32(ImGuiCol_FrameBg), rounding);
+	float radius = std::min(size.x, size.y) / 4;
+	ImVec2 half_pos = p_min + size / 2;
+	if (draw_loading)
+		draw_loading(half_pos, radius);
+	else if (IO.DrawLoading)
+		IO.DrawLoading(half_pos, radius);
+}
+
+bool IsOpaque(const unsigned char* rgba, size_t pixels)
+{
+	size_t i = 0;
+#if HIMAGE_MANAGER_SSE2
+	const __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+	for (; i + 4 <= pixels; i += 4)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i*)(rgba + i * 4));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(v, alpha), alpha)) != 0xFFFF)
+			return false;
+	}
+#endif
+	for (; i < pixels; i++)
+		if (rgba[i * 4 + 3] != 255)
+			return false;
+	return true;
+}
+
+//Smallest format of IO.UploadFormats (or rgba) holding an image whose source had channel components
+int ChooseUploadFormat(const HTexture& t, bool compress)
+{
+	int accepted = IO.UploadFormats | HImageFormatFlag(HImageFormat_RGBA8);
+	int channel = t.channel;
+	bool gray = channel <= 2;
+	bool opaque = channel == 1 || channel == 3 || IsOpaque(t.texture_data, (size_t)t.width * t.height);
+	if (compress && IO.CreateCompressedTexture && (t.width >= IO.CompressMinSize || t.height >= IO.CompressMinSize))
+	{
+		if (opaque && (accepted & HImageFormatFlag(HImageFormat_BC1)))
+			return HImageFormat_BC1;
+		if (accepted & HImageFormatFlag(HImageFormat_BC3))
+			return HImageFormat_BC3;
+	}
+	if (gray && opaque && (accepted & HImageFormatFlag(HImageFormat_R8)))
+		return HImageFormat_R8;
+	if (gray && (accepted & HImageFormatFlag(HImageFormat_RG8)))
+		return HImageFormat_RG8;
+	if (opaque && (accepted & HImageFormatFlag(HImageFormat_RGB565)))
+		return HImageFormat_RGB565;
+	if (!opaque && (accepted & HImageFormatFlag(HImageFormat_RGBA8_Premultiplied)))
+		return HImageFormat_RGBA8_Premultiplied;
+	return HImageFormat_RGBA8;
+}
+
+#if HIMAGE_MANAGER_SSE2
+//Packs 32 bit lanes holding 16 bit values without the signed saturation of _mm_packs_epi32
+inline __m128i PackLow16(__m128i a, __m128i b)
+{
+	return _mm_packs_epi32(_mm_srai_epi32(_mm_slli_epi32(a, 16), 16), _mm_srai_epi32(_mm_slli_epi32(b, 16), 16));
+}
+#endif
+
+//Converts rgba pixels in place, no format is larger than rgba so the output never overtakes the input
+void ConvertPixels(unsigned char* data, size_t pixels, int format)
+{
+	size_t i = 0;
+	switch (format)
+	{
+	case HImageFormat_R8:
+	{
+#if HIMAGE_MANAGER_SSE2
+		const __m128i low = _mm_set1_epi32(0xFF);
+		for (; i + 8 <= pixels; i += 8)
+		{
+			__m128i a = _mm_and_si128(_mm_loadu_si128((const __m128i*)(data + i * 4)), low);
+			__m128i b = _mm_and_si128(_mm_loadu_si128((const __m128i*)(data + i * 4 + 16)), low);
+			__m128i r = _mm_packs_epi32(a, b);
+			_mm_storel_epi64((__m128i*)(data + i), _mm_packus_epi16(r, r));
+		}
+#endif
+		for (; i < pixels; i++)
+			data[i] = data[i * 4];
+		break;
+	}
+	case HImageFormat_RG8:
+	{
+#if HIMAGE_MANAGER_SSE2
+		const __m128i low = _mm_set1_epi32(0xFF);
+		const __m128i high = _mm_set1_epi32(0xFF00);
+		for (; i + 8 <= pixels; i += 8)
+		{
+			__m128i a = _mm_loadu_si128((const __m128i*)(data + i * 4));
+			__m128i b = _mm_loadu_si128((const __m128i*)(data + i * 4 + 16));
+			a = _mm_or_si128(_mm_and_si128(a, low), _mm_and_si128(_mm_srli_epi32(a, 16), high));
+			b = _mm_or_si128(_mm_and_si128(b, low), _mm_and_si128(_mm_srli_epi32(b, 16), high));
+			_mm_storeu_si128((__m128i*)(data + i * 2), PackLow16(a, b));
+		}
+#endif
+		for (; i < pixels; i++)
+		{
+			data[i * 2] = data[i * 4];
+			data[i * 2 + 1] = data[i * 4 + 3];
+		}
+		break;
+	}
+	case HImageFormat_RGB565:
+	{
+#if HIMAGE_MANAGER_SSE2
+		const __m128i red = _mm_set1_epi32(0xF8), green = _mm_set1_epi32(0x7E0), blue = _mm_set1_epi32(0x1F);
+		for (; i + 8 <= pixels; i += 8)
+		{
+			__m128i p[2];
+			for (int half = 0; half < 2; half++)
+			{
+				__m128i v = _mm_loadu_si128((const __m128i*)(data + i * 4 + half * 16));
+				p[half] = _mm_or_si128(_mm_or_si128(_mm_slli_epi32(_mm_and_si128(v, red), 8), _mm_and_si128(_mm_srli_epi32(v, 5), green)), _mm_and_si128(_mm_srli_epi32(v, 19), blue));
+			}
+			_mm_storeu_si128((__m128i*)(data + i * 2), PackLow16(p[0], p[1]));
+		}
+#endif
+		for (; i < pixels; i++)
+		{
+			const unsigned char* s = data + i * 4;
+			unsigned int p = ((s[0] & 0xF8) << 8) | ((s[1] & 0xFC) << 3) | (s[2] >> 3);
+			data[i * 2] = (unsigned char)(p & 0xFF);
+			data[i * 2 + 1] = (unsigned char)(p >> 8);
+		}
+		break;
+	}
+	case HImageFormat_RGBA8_Premultiplied:
+	{
+#if HIMAGE_MANAGER_SSE2
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i round = _mm_set1_epi16(128);
+		const __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+		for (; i + 4 <= pixels; i += 4)
+		{
+			__m128i v = _mm_loadu_si128((const __m128i*)(data + i * 4));
+			__m128i c[2] = { _mm_unpacklo_epi8(v, zero), _mm_unpackhi_epi8(v, zero) };
+			for (int half = 0; half < 2; half++)
+			{
+				__m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(c[half], _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+				__m128i m = _mm_add_epi16(_mm_mullo_epi16(c[half], a), round);
+				c[half] = _mm_srli_epi16(_mm_add_epi16(m, _mm_srli_epi16(m, 8)), 8);
+			}
+			__m128i r = _mm_packus_epi16(c[0], c[1]);
+			_mm_storeu_si128((__m128i*)(data + i * 4), _mm_or_si128(_mm_andnot_si128(alpha, r), _mm_and_si128(alpha, v)));
+		}
+#endif
+		for (; i < pixels; i++)
+		{
+			unsigned char* p = data + i * 4;
+			for (int c = 0; c < 3; c++)
+			{
+				unsigned int m = p[c] * p[3] + 128;
+				p[c] = (unsigned char)((m + (m >> 8)) >> 8);
+			}
+		}
+		break;
+	}
+	}
+}
+
+inline unsigned short ToRGB565(const unsigned char* c)
+{
+	return (unsigned short)(((c[0] & 0xF8) << 8) | ((c[1] & 0xFC) << 3) | (c[2] >> 3));
+}
+
+inline void FromRGB565(unsigned short v, int* c)
+{
+	c[0] = ((v >> 11) & 0x1F) * 255 / 31;
+	c[1] = ((v >> 5) & 0x3F) * 255 / 63;
+	c[2] = (v & 0x1F) * 255 / 31;
+}
+
+//BC1 color block of 16 rgba pixels, end points from the inset bounding box of the block
+void EncodeColorBlock(const unsigned char* block, unsigned char* out)
+{
+	unsigned char lo[4] = { 255, 255, 255, 0 }, hi[4] = { 0, 0, 0, 0 };
+	for (int i = 0; i < 16; i++)
+		for (int c = 0; c < 3; c++)
+		{
+			lo[c] = std::min(lo[c], block[i * 4 + c]);
+			hi[c] = std::max(hi[c], block[i * 4 + c]);
+		}
+	for (int c = 0; c < 3; c++)
+	{
+		int inset = (hi[c] - lo[c]) >> 4;
+		lo[c] = (unsigned char)(lo[c] + inset);
+		hi[c] = (unsigned char)(hi[c] - inset);
+	}
+	unsigned short c0 = ToRGB565(hi), c1 = ToRGB565(lo);
+	if (c0 < c1)
+		std::swap(c0, c1);
+
+	unsigned int indices = 0;
+	if (c0 != c1)
+	{
+		int palette[4][3];
+		FromRGB565(c0, palette[0]);
+		FromRGB565(c1, palette[1]);
+		for (int c = 0; c < 3; c++)
+		{
+			palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+			palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+		}
+		for (int i = 0; i < 16; i++)
+		{
+			int best = 0, best_error = 0x7FFFFFFF;
+			for (int p = 0; p < 4; p++)
+			{
+				int error = 0;
+				for (int c = 0; c < 3; c++)
+				{
+					int d = block[i * 4 + c] - palette[p][c];
+					error += d * d;
+				}
+				if (error < best_error)
+				{
+					best_error = error;
+					best = p;
+				}
+			}
+			indices |= (unsigned int)best << (i * 2);
+		}
+	}
+	out[0] = (unsigned char)(c0 & 0xFF);
+	out[1] = (unsigned char)(c0 >> 8);
+	out[2] = (unsigned char)(c1 & 0xFF);
+	out[3] = (unsigned char)(c1 >> 8);
+	for (int b = 0; b < 4; b++)
+		out[4 + b] = (unsigned char)(indices >> (b * 8));
+}
+
+//BC3 alpha block, 8 interpolated values between the block minimum and maximum
+void EncodeAlphaBlock(const unsigned char* block, unsigned char* out)
+{
+	int a0 = 0, a1 = 255;
+	for (int i = 0; i < 16; i++)
+	{
+		a0 = std::max(a0, (int)block[i * 4 + 3]);
+		a1 = std::min(a1, (int)block[i * 4 + 3]);
+	}
+	unsigned long long indices = 0;
+	if (a0 != a1)
+	{
+		int palette[8] = { a0, a1 };
+		for (int p = 1; p < 7; p++)
+			palette[p + 1] = ((7 - p) * a0 + p * a1) / 7;
+		for (int i = 0; i < 16; i++)
+		{
+			int best = 0, best_error = 256;
+			for (int p = 0; p < 8; p++)
+			{
+				int error = abs(block[i * 4 + 3] - palette[p]);
+				if (error < best_error)
+				{
+					best_error = error;
+					best = p;
+				}
+			}
+			indices |= (unsigned long long)best << (i * 3);
+		}
+	}
+	out[0] = (unsigned char)a0;
+	out[1] = (unsigned char)a1;
+	for (int b = 0; b < 6; b++)
+		out[2 + b] = (unsigned char)(indices >> (b * 8));
+}
+
+//Encodes rgba into BC1 / BC3 blocks, edge blocks repeat the last row and column
+unsigned char* CompressImage(const unsigned char* rgba, int w, int h, int format)
+{
+	int block_bytes = format == HImageFormat_BC1 ? 8 : 16;
+	unsigned char* blocks = (unsigned char*)STBI_MALLOC(HImageDataSize(format, w, h));
+	if (!blocks)
+		return 0;
+	unsigned char* out = blocks;
+	unsigned char block[64];
+	for (int by = 0; by < h; by += 4)
+		for (int bx = 0; bx < w; bx += 4, out += block_bytes)
+		{
+			for (int y = 0; y < 4; y++)
+				for (int x = 0; x < 4; x++)
+					memcpy(block + (y * 4 + x) * 4, rgba + ((size_t)std::min(by + y, h - 1) * w + std::min(bx + x, w - 1)) * 4, 4);
+			if (format == HImageFormat_BC3)
+				EncodeAlphaBlock(block, out);
+			EncodeColorBlock(block, out + block_bytes - 8);
+		}
+	return blocks;
+}
+
+//Runs on the worker after decoding, sets t.format. compress : the texture is made by IO.CreateTexture, so it may go to IO.CreateCompressedTexture
+void ConvertUploadFormat(HTexture& t, bool compress)
+{
+	if (!IO.UploadFormats)
+	{
+		t.format = t.channel;
+		return;
+	}
+	t.format = ChooseUploadFormat(t, compress);
+	if (HImageFormatIsCompressed(t.format))
+	{
+		unsigned char* blocks = CompressImage(t.texture_data, t.width, t.height, t.format);
+		if (blocks)
+		{
+			stbi_image_free(t.texture_data);
+			t.texture_data = blocks;
+			return;
+		}
+		t.format = HImageFormat_RGBA8;
+	}
+	ConvertPixels(t.texture_data, (size_t)t.width * t.height, t.format);
+}
+
+HTextureID CreateTexture(const HTexture& t, CreateTextureCallback create)
+{
+	if (HImageFormatIsCompressed(t.format))
+		return IO.CreateCompressedTexture(t.texture_data, HImageDataSize(t.format, t.width, t.height), t.width, t.height, t.format);
+	return create(t.texture_data, t.width, t.height, t.format);
+}
+
+//Texture (or atlas place) of a static cache entry
+void CreateStaticTexture(HImageInfo& info, const HTexture& t, CreateTextureCallback create)
+{
+	info.image.SetInfo(t);
+	info.format = t.format;
+	if (!AddToAtlas(info, t, create))
+		info.image.texture = CreateTexture(t, create);
+}
+
+//content_key set by DecodeStaticImage : uses the shared texture, whose reference was taken when t skipped its pixels, or shares the new one
+void CreateStaticTexture(HImageInfo& info, const HTexture& t, CreateTextureCallback create, uint64_t content_key)
+{
+	if (content_key)
+	{
+		std::lock_guard<std::mutex> lock(SharedTextureMutex);
+		auto found = SharedTextures.find(content_key);
+		if (found != SharedTextures.end())
+		{
+			if (t.texture_data)  //Decoded by two loads at once, the later pixels are dropped
+				found->second.refs++;
+			info.image = found->second.image;
+			info.format = found->second.format;
+			info.content_key = content_key;
+			return;
+		}
+	}
+	if (!t.texture_data)
+		return;
+	CreateStaticTexture(info, t, create);
+	if (content_key && info.image.texture && info.atlas_page < 0)
+	{
+		HSharedTexture shared;
+		shared.image = info.image;
+		shared.format = info.format;
+		shared.unload = info.unload;
+		shared.bytes = HImageDataSize(info.format, info.image.width, info.image.height);
+		shared.refs = 1;
+		std::lock_guard<std::mutex> lock(SharedTextureMutex);
+		SharedTextures[content_key] = shared;
+		info.content_key = content_key;
+		CacheBytes += shared.bytes;
+	}
+}
+
+//Halves an rgba image with a 2x2 box filter, an odd last row or column is dropped
+void HalveImage(const unsigned char* src, int w, int h, unsigned char* dst)
+{
+	int dw = w / 2, dh = h / 2;
+	for (int y = 0; y < dh; y++)
+	{
+		const unsigned char* r0 = src + (size_t)w * 4 * (2 * y);
+		const unsigned char* r1 = r0 + (size_t)w * 4;
+		unsigned char* out = dst + (size_t)dw * 4 * y;
+		int x = 0;
+#if HIMAGE_MANAGER_SSE2
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i round = _mm_set1_epi16(2);
+		for (; x + 4 <= dw; x += 4)
+		{
+			//8 source pixels of both rows give 4 output pixels
+			__m128i a0 = _mm_loadu_si128((const __m128i*)(r0 + x * 8));
+			__m128i a1 = _mm_loadu_si128((const __m128i*)(r0 + x * 8 + 16));
+			__m128i b0 = _mm_loadu_si128((const __m128i*)(r1 + x * 8));
+			__m128i b1 = _mm_loadu_si128((const __m128i*)(r1 + x * 8 + 16));
+			__m128i p01 = _mm_add_epi16(_mm_unpacklo_epi8(a0, zero), _mm_unpacklo_epi8(b0, zero));
+			__m128i p23 = _mm_add_epi16(_mm_unpackhi_epi8(a0, zero), _mm_unpackhi_epi8(b0, zero));
+			__m128i p45 = _mm_add_epi16(_mm_unpacklo_epi8(a1, zero), _mm_unpacklo_epi8(b1, zero));
+			__m128i p67 = _mm_add_epi16(_mm_unpackhi_epi8(a1, zero), _mm_unpackhi_epi8(b1, zero));
+			__m128i q01 = _mm_unpacklo_epi64(_mm_add_epi16(p01, _mm_srli_si128(p01, 8)), _mm_add_epi16(p23, _mm_srli_si128(p23, 8)));
+			__m128i q23 = _mm_unpacklo_epi64(_mm_add_epi16(p45, _mm_srli_si128(p45, 8)), _mm_add_epi16(p67, _mm_srli_si128(p67, 8)));
+			q01 = _mm_srli_epi16(_mm_add_epi16(q01, round), 2);
+			q23 = _mm_srli_epi16(_mm_add_epi16(q23, round), 2);
+			_mm_storeu_si128((__m128i*)(out + x * 4), _mm_packus_epi16(q01, q23));
+		}
+#endif
+		for (; x < dw; x++)
+			for (int c = 0; c < 4; c++)
+				out[x * 4 + c] = (unsigned char)((r0[x * 8 + c] + r0[x * 8 + 4 + c] + r1[x * 8 + c] + r1[x * 8 + 4 + c] + 2) >> 2);
+	}
+}
+
+//Halves the image while it still covers lod_size x lod_size
+void DownscaleToLod(HTexture& t, int lod_size)
+{
+	while (lod_size > 0 && t.width / 2 >= lod_size && t.height / 2 >= lod_size)
+	{
+		unsigned char* half = (unsigned char*)STBI_MALLOC((size_t)(t.width / 2) * (t.height / 2) * 4);
+		if (!half)
+			return;
+		HalveImage(t.texture_data, t.width, t.height, half);
+		stbi_image_free(t.texture_data);
+		t.texture_data = half;
+		t.width /= 2;
+		t.height /= 2;
+	}
+}
+
+//Names ending in ".gif" (any case)
+inline bool IsGifName(const char* name)
+{
+	size_t length = strlen(name);
+	return length >= 4 && name[length - 4] == '.' && (name[length - 3] | 0x20) == 'g' && (name[length - 2] | 0x20) == 'i' && (name[length - 1] | 0x20) == 'f';
+}
+
+//Image pack : header, entries, names, then the files as they were on disk (16 byte aligned). Offsets are from the start of the pack
+struct HImagePackHeader
+{
+	char magic[4];
+	uint32_t version;
+	uint32_t count;
+	uint32_t names_size;
+};
+
+struct HImagePackEntry
+{
+	uint64_t name_hash;  //HashImageKey of the name
+	uint64_t offset;
+	uint64_t size;
+	uint32_t name_offset;
+	uint32_t name_length;
+	int32_t width, height, channel;
+	uint32_t flags;
+};
+const uint32_t HImagePackVersion = 1;
+enum { HImagePackFlag_Gif = 1 };
+
+bool MountImagePack(const unsigned char* data, size_t size, const std::shared_ptr<HFileSource>& file)
+{
+	HImagePackHeader header;
+	if (size < sizeof(header))
+		return false;
+	memcpy(&header, data, sizeof(header));
+	size_t names_begin = sizeof(header) + (size_t)header.count * sizeof(HImagePackEntry);
+	if (memcmp(header.magic, "HIPK", 4) != 0 || header.version != HImagePackVersion || names_begin > size || header.names_size > size - names_begin)
+	{
+		printf("\n Error : Not an image pack (version %u)", HImagePackVersion);
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(ImagePackMutex);
+	for (uint32_t i = 0; i < header.count; i++)
+	{
+		HImagePackEntry entry;
+		memcpy(&entry, data + sizeof(header) + (size_t)i * sizeof(entry), sizeof(entry));
+		if (entry.offset > size || entry.size > size - entry.offset || (uint64_t)entry.name_offset + entry.name_length > header.names_size)
+			continue;
+		HPackedImage& packed = PackedImages[entry.name_hash];
+		packed.data = data + entry.offset;
+		packed.size = (size_t)entry.size;
+		packed.name = (const char*)data + names_begin + entry.name_offset;
+		packed.name_length = entry.name_length;
+		packed.width = entry.width;
+		packed.height = entry.height;
+		packed.channel = entry.channel;
+		packed.gif = (entry.flags & HImagePackFlag_Gif) != 0;
+		packed.file = file;
+	}
+	return true;
+}
+
+bool FindPackedImage(const char* name, HPackedImage& out)
+{
+	std::lock_guard<std::mutex> lock(ImagePackMutex);
+	if (PackedImages.empty())
+		return false;
+	auto found = PackedImages.find(HashImageKey(name));
+	if (found == PackedImages.end() || strlen(name) != found->second.name_length || memcmp(name, found->second.name, found->second.name_length) != 0)
+		return false;
+	out = found->second;
+	return true;
+}
+
+bool HImageManager::ImageLoader::OpenImagePack(const char* path)
+{
+	std::shared_ptr<HFileSource> file = HFileSource::Open(path);
+	if (!file)
+	{
+		printf("\n Error : Load Image pack %s", path);
+		return false;
+	}
+	return MountImagePack(file->data, file->size, file);
+}
+
+bool HImageManager::ImageLoader::OpenImagePack(const void* data, size_t size)
+{
+	return MountImagePack((const unsigned char*)data, size, 0);
+}
+
+void HImageManager::ImageLoader::CloseImagePacks()
+{
+	std::lock_guard<std::mutex> lock(ImagePackMutex);
+	PackedImages.clear();
+}
+
+bool HImageManager::ImageLoader::GetPackedImageSize(const char* name, int& width, int& height)
+{
+	HPackedImage packed;
+	if (!FindPackedImage(name, packed))
+		return false;
+	width = packed.width;
+	height = packed.height;
+	return true;
+}
+
+//File of IO.DecodedCacheDirectory, followed by the HImageDataSize bytes given to the texture callbacks
+struct HDecodedCacheHeader
+{
+	char magic[4];
+	uint32_t version;
+	int32_t width, height, channel, format;
+	uint64_t content_hash;
+	uint64_t data_size;
+};
+const uint32_t HDecodedCacheVersion = 1;  //Bump when decoding or conversion output changes
+
+//Content hash and everything changing the decoded pixels
+uint64_t DecodedContentKey(uint64_t content_hash, int lod_size, bool compress)
+{
+	int params[4] = { lod_size, IO.UploadFormats, compress && IO.CreateCompressedTexture ? IO.CompressMinSize : -1, (int)HDecodedCacheVersion };
+	return HashBytes((const unsigned char*)params, sizeof(params), content_hash);
+}
+
+std::string DecodedCachePath(uint64_t content_key)
+{
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.himg", (unsigned long long)content_key);
+	return std::string(IO.DecodedCacheDirectory).append("/").append(name);
+}
+
+bool ReadDecodedCache(const std::string& path, uint64_t content_hash, HTexture& t, std::shared_ptr<HFileSource>& source)
+{
+	std::shared_ptr<HFileSource> file = HFileSource::Open(path.c_str());
+	if (!file || file->size < sizeof(HDecodedCacheHeader))
+		return false;
+	HDecodedCacheHeader header;
+	memcpy(&header, file->data, sizeof(header));
+	if (memcmp(header.magic, "HIMG", 4) != 0 || header.version != HDecodedCacheVersion || header.content_hash != content_hash
+		|| header.width <= 0 || header.height <= 0 || header.data_size != HImageDataSize(header.format, header.width, header.height)
+		|| file->size != sizeof(header) + header.data_size)
+		return false;
+	t.width = header.width;
+	t.height = header.height;
+	t.channel = header.channel;
+	t.format = header.format;
+	t.texture_data = file->data + sizeof(header);
+	source = file;
+	return true;
+}
+
+//Written to a temporary file first so other threads or processes never map a partial one
+void WriteDecodedCache(const std::string& path, uint64_t content_hash, const HTexture& t)
+{
+	HDecodedCacheHeader header = { { 'H', 'I', 'M', 'G' }, HDecodedCacheVersion, t.width, t.height, t.channel, t.format, content_hash, HImageDataSize(t.format, t.width, t.height) };
+	std::string temp = path + "." + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+	{
+		std::ofstream file(temp, std::ios::binary);
+		if (!file.good())
+			return;
+		file.write((const char*)&header, sizeof(header));
+		file.write((const char*)t.texture_data, header.data_size);
+		if (!file.good())
+		{
+			file.close();
+			std::remove(temp.c_str());
+			return;
+		}
+	}
+	if (std::rename(temp.c_str(), path.c_str()) != 0)
+		std::remove(temp.c_str());
+}
+
+//Decodes file content into t ready for CreateTexture. With IO.DecodedCacheDirectory a cached result is mapped instead, source then owns t.texture_data.
+//content_key given : set for IO.DeduplicateContent on success, t is left without pixels when that texture already exists (a reference is taken)
+bool DecodeStaticImage(const unsigned char* content, size_t size, int lod_size, bool compress, HTexture& t, std::shared_ptr<HFileSource>& source, uint64_t* content_key = 0)
+{
+	if (size > INT_MAX)
+		return false;
+	bool share = content_key && compress && IO.DeduplicateContent;
+	uint64_t content_hash = 0;
+	uint64_t key = 0;
+	if (IO.DecodedCacheDirectory || share)
+	{
+		content_hash = HashBytes(content, size);
+		key = DecodedContentKey(content_hash, lod_size, compress);
+	}
+	if (share && AcquireSharedTexture(key, t))
+	{
+		*content_key = key;
+		return true;
+	}
+	std::string cache_path;
+	if (IO.DecodedCacheDirectory)
+	{
+		cache_path = DecodedCachePath(key);
+		if (ReadDecodedCache(cache_path, content_hash, t, source))
+		{
+			if (share)
+				*content_key = key;
+			return true;
+		}
+	}
+	t.texture_data = stbi_load_from_memory(content, (int)size, &t.width, &t.height, &t.channel, 4);
+	if (t.texture_data == NULL)
+		return false;
+	if (HImageThreadPool::TaskExpired())
+	{
+		stbi_image_free(t.texture_data);
+		t.texture_data = 0;
+		return false;
+	}
+	DownscaleToLod(t, lod_size);
+	ConvertUploadFormat(t, compress);
+	if (IO.DecodedCacheDirectory)
+		WriteDecodedCache(cache_path, content_hash, t);
+	if (share)
+		*content_key = key;
+	return true;
+}
+
+bool DecodeStaticImageFile(const char* filename, int lod_size, bool compress, HTexture& t, std::shared_ptr<HFileSource>& source, uint64_t* content_key = 0)
+{
+	HPackedImage packed;
+	if (FindPackedImage(filename, packed))
+		return DecodeStaticImage(packed.data, packed.size, lod_size, compress, t, source, content_key);
+	std::shared_ptr<HFileSource> file = HFileSource::Open(filename);
+	return file && DecodeStaticImage(file->data, file->size, lod_size, compress, t, source, content_key);
+}
 
-HImageManagerIO& HImageManager::GetIO()
+void FreeStaticImage(HTexture& t, std::shared_ptr<HFileSource>& source)
 {
-	return IO;
+	if (source)
+		source.reset();
+	else
+		stbi_image_free(t.texture_data);
+	t.texture_data = 0;
 }
 
-bool GetHTextureFormFile(HBitImage& bit_image, size_t& bit_image_size, HImageInfo& info, CreateTextureCallback loader)
+bool GetHTextureFormMemory(const unsigned char* data, size_t size, HImageInfo& info, CreateTextureCallback loader)
 {
 	HTexture t;
-	t.texture_data = stbi_load_from_memory(bit_image.data(), bit_image_size, &t.width, &t.height, &t.channel, 4);
-	if (t.texture_data == NULL)
+	std::shared_ptr<HFileSource> source;
+	uint64_t content_key = 0;
+	if (!DecodeStaticImage(data, size, 0, loader == IO.CreateTexture, t, source, &content_key))
 	{
-		printf("\n Error : Load HBitImage %d", (long long)&bit_image);
+		printf("\n Error : Load image from memory %s", info.id.c_str());
 		return false;
 	}
-	info.image.SetInfo(t);
-	info.image.texture = loader(t.texture_data, t.width, t.height, t.channel);
+	CreateStaticTexture(info, t, loader, content_key);
 
-	stbi_image_free(t.texture_data);
+	FreeStaticImage(t, source);
+	return true;
 }
 
-bool GetHTextureFormFile(const char* filename, HImageInfo& info, CreateTextureCallback loader)
+bool GetHTextureFormFile(const char* filename, HImageInfo& info, CreateTextureCallback loader, int lod_size = 0)
 {
 	HTexture t;
-	t.texture_data = stbi_load(filename, &t.width, &t.height, &t.channel, 4);
-	if (t.texture_data == NULL)
+	std::shared_ptr<HFileSource> source;
+	uint64_t content_key = 0;
+	if (!DecodeStaticImageFile(filename, lod_size, loader == IO.CreateTexture, t, source, &content_key))
 	{
 		printf("\n Error : Load Image %s", filename);
 		return false;
 	}
-	info.image.SetInfo(t);
-	info.image.texture = loader(t.texture_data, t.width, t.height, t.channel);
+	CreateStaticTexture(info, t, loader, content_key);
+
+	FreeStaticImage(t, source);
+	return true;
+}
 
-	stbi_image_free(t.texture_data);
+void AsynchronousProcessingImage(HDecodedImage decoded)
+{
+	if (!DecodeStaticImageFile(decoded.id.c_str(), decoded.lod_size, !decoded.load, decoded.texture, decoded.source, &decoded.content_key))
+		printf("\n Error : Load Image %s", decoded.id.c_str());
+	PushDecodedImage(decoded);
 }
 #if HIMAGE_MANAGER_GIF_IMAGE_ENABLED
+//Expands every frame, or with IO.GifStreaming only decodes the first one and keeps the compressed data (source, or a copy of buffer)
+bool LoadGifFromMemory(const unsigned char* buffer, size_t size, HImageInfo_gif& info, std::shared_ptr<HFileSource> source = 0)
+{
+	if (size > INT_MAX)
+		return false;
+	if (IO.GifStreaming)
+	{
+		std::shared_ptr<HGifStream> stream = std::make_shared<HGifStream>(source ? source : HFileSource::FromMemory(buffer, size), IO.GifStreamFramesAhead);
+		if (!stream->Open())
+			return false;
+		info.image.width = stream->width();
+		info.image.height = stream->height();
+		info.image.channel = stream->comp;
+		info.stream = stream;
+		return true;
+	}
+	info.data = stbi_load_gif_from_memory(buffer, (int)size, &info.delays, &info.image.width, &info.image.height, &info.frames, &info.image.channel, 4);
+	return info.data != 0;
+}
+
 bool GetHTextureFormFile(const char* filename, HImageInfo_gif& info)
 {
-	FILE* f = stbi__fopen(filename, "rb");
-	if (!f) return stbi__errpuc("can't fopen", "Unable to open file");
-	fseek(f, 0, SEEK_END);
-	int bufSize = ftell(f);
-	unsigned char* buf = (unsigned char*)malloc(sizeof(unsigned char) * bufSize);
-	if (buf)
+	HPackedImage packed;
+	if (FindPackedImage(filename, packed))
+		return LoadGifFromMemory(packed.data, packed.size, info);
+	std::shared_ptr<HFileSource> source = HFileSource::Open(filename);
+	if (!source)
 	{
-		fseek(f, 0, SEEK_SET);
-		fread(buf, 1, bufSize, f);
-		info.data = stbi_load_gif_from_memory(buf, bufSize, &info.delays, &info.image.width, &info.image.height, &info.frames, &info.image.channel, 4);
-		free(buf);
-		buf = NULL;
+		printf("HImGuiImageManager ->GetHTextureFormFile (GIF)-> Error -> Unable to open file %s", filename);
+		return false;
 	}
-	else
+	LoadGifFromMemory(source->data, source->size, info, source);
+	return info.data != 0 || info.stream;
+}
+bool GetHTextureFormMemory(const std::shared_ptr<HFileSource>& bytes, HImageInfo_gif& info)
+{
+	return LoadGifFromMemory(bytes->data, bytes->size, info, bytes);
+}
+//IO.GifFrameAtlas, runs on the worker : rearranges the decoded frames into atlas pages, or leaves them alone when they do not fit
+void PackGifAtlas(HImageInfo_gif& info)
+{
+	int w = info.image.width, h = info.image.height;
+	int max_size = IO.GifAtlasMaxSize;
+	if (!IO.GifFrameAtlas || !info.data || info.frames < 2 || w <= 0 || h <= 0 || w > max_size || h > max_size || HImageThreadPool::TaskExpired())
+		return;
+
+	int columns = std::min(max_size / w, info.frames);
+	int rows = std::min(max_size / h, (info.frames + columns - 1) / columns);
+	int per_page = columns * rows;
+	int pages = (info.frames + per_page - 1) / per_page;
+	if (pages > IO.GifAtlasMaxPages)
+		return;
+
+	size_t atlas_row = (size_t)columns * w * 4;
+	size_t page_bytes = atlas_row * rows * h;
+	if (IO.TextureMemoryBudgetBytes && page_bytes * pages > IO.TextureMemoryBudgetBytes)
+		return;  //Would be evicted as soon as it is cached
+	unsigned char* atlas = (unsigned char*)STBI_MALLOC(page_bytes * pages);
+	if (!atlas)
+		return;
+	memset(atlas, 0, page_bytes * pages);
+	for (int frame = 0; frame < info.frames; frame++)
 	{
-		printf("HImGuiImageManager ->GetHTextureFormFile (GIF)-> Error -> Out of memory");
+		int index = frame % per_page;
+		unsigned char* dst = atlas + page_bytes * (frame / per_page) + atlas_row * h * (index / columns) + (size_t)w * 4 * (index % columns);
+		const unsigned char* src = info.get_frame_image(frame);
+		for (int y = 0; y < h; y++)
+			memcpy(dst + atlas_row * y, src + (size_t)w * 4 * y, (size_t)w * 4);
 	}
-	fclose(f);
+	stbi_image_free(info.data);
+	info.data = atlas;
+	info.atlas_columns = columns;
+	info.atlas_frames_per_page = per_page;
+	info.atlas_width = columns * w;
+	info.atlas_height = rows * h;
+}
+
+//IO.GifCompactFrames, runs on the worker after PackGifAtlas
+void CompactGifFrames(HImageInfo_gif& info)
+{
+	if (!IO.GifCompactFrames || !info.data || info.IsAtlas() || HImageThreadPool::TaskExpired())
+		return;
+	std::shared_ptr<HGifCompactFrames> compact = std::make_shared<HGifCompactFrames>();
+	compact->Build(info.data, info.image.width, info.image.height, info.frames);
+	stbi_image_free(info.data);
+	info.data = 0;
+	info.compact = compact;
 }
-bool GetHTextureFormFile(HBitImage*& bit_image, size_t& size, HImageInfo_gif& info)
+
+//Browsers play delays of 10 ms or less at 100 ms, so do we
+inline int GifFrameDelay(int delay)
 {
-	info.data = stbi_load_gif_from_memory(bit_image->data(), size, &info.delays, &info.image.width, &info.image.height, &info.frames, &info.image.channel, 4);
+	return delay > 10 ? delay : 100;
 }
-void GifUpdata(HImageInfo_gif& info, float speed, CreateTextureCallback create, DeleteTextureCallback delete_)
+
+//Uploads frame 0, or every atlas page and then drops the cpu copy. Playback starts now
+void CreateGifTextures(HImageInfo_gif& info, CreateTextureCallback create)
 {
-	float delay = info.delays[info.current_frame] / speed;
-	if (info.delay_buffer >= delay)
+	info.start_time = CacheTime;
+	info.shown_frame = 0;
+	int units = 0;
+	for (int frame = 0; info.delays && frame < info.frames; frame++)
 	{
-		if (info.image.texture)
-		{
-			if (delete_)
-				delete_(info.image.texture);
-			else
-				IO.DeleteTexture(info.image.texture);
+		units += GifFrameDelay(info.delays[frame]);
+		info.frame_end.push_back(units);
+	}
+	if (info.stream)
+		info.next_frame_units = GifFrameDelay(info.stream->shown_delay);
 
-			info.image.texture = 0;
-		}
+	if (info.stream)
+	{
+		info.image.texture = create(info.stream->shown.data(), info.image.width, info.image.height, RgbaUploadFormat(info.image.channel));
+		return;
+	}
+	if (info.compact)
+	{
+		HGifRect changed;
+		info.image.texture = create(info.compact->Seek(0, changed), info.image.width, info.image.height, RgbaUploadFormat(info.image.channel));
+		return;
+	}
+	if (!info.data)
+		return;
+	if (!info.IsAtlas())
+	{
+		info.image.texture = create(info.get_frame_image(0), info.image.width, info.image.height, RgbaUploadFormat(info.image.channel));
+		return;
+	}
+	for (int page = 0; page < info.AtlasPageCount(); page++)
+		info.atlas_pages.push_back(create(info.data + info.AtlasPageBytes() * page, info.atlas_width, info.atlas_height, RgbaUploadFormat(info.image.channel)));
+	stbi_image_free(info.data);
+	info.data = 0;
+	info.SetAtlasFrame(0);
+}
+
+void ReleaseGifAtlas(HImageInfo_gif& info)
+{
+	for (HTextureID page : info.atlas_pages)
+	{
+		if (!page)
+			continue;
+		if (info.unload)
+			info.unload(page);
+		else
+			IO.DeleteTexture(page);
+	}
+	if (!info.atlas_pages.empty())
+		info.image.texture = 0;
+	info.atlas_pages.clear();
+}
+
+//Replaces the texture content with next. Either previous (what it holds now) or the changed rectangle is given
+void UploadGifFrame(HImageInfo_gif& info, const unsigned char* previous, unsigned char* next, CreateTextureCallback create, DeleteTextureCallback delete_, const HGifRect* changed = 0)
+{
+	if (info.image.texture && IO.UpdateTexture && !create)
+	{
+		HGifRect rect = changed ? *changed : GifDirtyRect(previous, next, info.image.width, info.image.height);
+		if (rect.w > 0)
+			IO.UpdateTexture(info.image.texture, next, info.image.width, info.image.height, RgbaUploadFormat(info.image.channel), rect.x, rect.y, rect.w, rect.h);
+		return;
+	}
 
-		if (create)
-			info.image.texture = create(info.get_frame_image(info.current_frame), info.image.width, info.image.height, info.image.channel);
+	if (info.image.texture)
+	{
+		if (delete_)
+			delete_(info.image.texture);
 		else
-			info.image.texture = IO.CreateTexture(info.get_frame_image(info.current_frame), info.image.width, info.image.height, info.image.channel);
+			IO.DeleteTexture(info.image.texture);
+
+		info.image.texture = 0;
+	}
+
+	if (create)
+		info.image.texture = create(next, info.image.width, info.image.height, RgbaUploadFormat(info.image.channel));
+	else
+		info.image.texture = IO.CreateTexture(next, info.image.width, info.image.height, RgbaUploadFormat(info.image.channel));
+}
+
+//Owned by the Fill task, so filling is cleared once the task ran or was dropped without running (Shutdown, cancelled)
+struct HGifFillGuard
+{
+	std::shared_ptr<HGifStream> stream;
+
+	~HGifFillGuard()
+	{
+		stream->filling = false;
+	}
+};
+
+void RequestGifStreamFill(std::shared_ptr<HGifStream>& stream)
+{
+	stream->request->priority = ImGui::GetFrameCount();
+	if (stream->NeedsFill() && !stream->filling.exchange(true))
+	{
+		std::shared_ptr<HGifFillGuard> guard = std::make_shared<HGifFillGuard>();
+		guard->stream = stream;
+		ThreadPool.Submit([guard]() { guard->stream->Fill(); }, stream->request);
+	}
+}
 
-		info.current_frame++;
-		if (info.current_frame >= info.frames)
-			info.current_frame = 1;
-		info.delay_buffer = 0;
+//Called once per frame by HImageManager::updata for the gifs drawn last frame. The frame to show is worked out from the time
+//since the gif started playing, frames in between are skipped without being uploaded
+void GifUpdata(HImageInfo_gif& info)
+{
+	double units = (CacheTime - info.start_time) * info.speed;
+	if (info.stream)
+	{
+		HGifStream& stream = *info.stream;
+		bool popped = false;
+		int delay;
+		while (units >= info.next_frame_units && stream.Pop(delay))
+		{
+			popped = true;
+			info.next_frame_units += GifFrameDelay(delay);
+		}
+		if (popped && info.image.texture)
+		{
+			UploadGifFrame(info, stream.shown.data(), stream.next.data(), info.load, info.unload);
+			stream.shown.swap(stream.next);
+		}
+		if (units >= info.next_frame_units)
+			info.next_frame_units = units;  //Decoding fell behind, carry on from here instead of racing to catch up
+		RequestGifStreamFill(info.stream);
+		return;
+	}
+
+	if (info.frame_end.size() < 2 || (!info.data && !info.compact && !info.IsAtlas()))
+		return;
+	int time = (int)fmod(units, (double)info.frame_end.back());
+	int frame = (int)(std::upper_bound(info.frame_end.begin(), info.frame_end.end(), time) - info.frame_end.begin());
+	if (frame == info.shown_frame || frame >= info.frames)
+		return;
+
+	if (info.IsAtlas())
+	{
+		info.SetAtlasFrame(frame);
+	}
+	else if (info.compact)
+	{
+		HGifRect changed;
+		unsigned char* canvas = info.compact->Seek(frame, changed);
+		UploadGifFrame(info, 0, canvas, info.load, info.unload, &changed);
 	}
 	else
-		info.delay_buffer += GImGui->IO.DeltaTime;
+	{
+		UploadGifFrame(info, info.get_frame_image(info.shown_frame), info.get_frame_image(frame), info.load, info.unload);
+	}
+	info.shown_frame = frame;
+}
+
+//What the last GetImage_gif call asked for, used by the next GifUpdata
+inline void SetGifPlayback(HImageInfo_gif& info, float speed, CreateTextureCallback load, DeleteTextureCallback unload)
+{
+	info.speed = speed;
+	info.load = (load && unload) ? load : 0;
 }
+
 #if HIMAGE_MANAGER_URL_IMAGE_ENABLED
-bool GetHTextureFormURL(const char* url, const char* path, const char* id, bool CacheFile, HImageInfo_gif& info)
+//false when the request failed, the connection is then not reused
+bool GetHTextureFormURL(httplib::Client& client, const char* path, const char* id, bool CacheFile, HImageInfo_gif& info)
 {
-	httplib::Client client(url); // 滻ΪʵʵURL
 	auto response = client.Get(path); // 滻Ϊʵʵͼ·
 	if (response) {
 		// Ӧлȡͼ
@@ -249,77 +2776,56 @@ bool GetHTextureFormURL(const char* url, const char* path, const char* id, bool
 				file.close();
 			}
 		}
-		info.data = stbi_load_gif_from_memory(imageData.data(), imageData.size(), &info.delays, &info.image.width, &info.image.height, &info.frames, &info.image.channel, 4);
+		LoadGifFromMemory(imageData.data(), imageData.size(), info);
 		imageData.clear();
 	}
-	client.stop();
+	return (bool)response;
 }
 #endif // HIMAGE_MANAGER_URL_IMAGE_ENABLED
 #endif
 #if HIMAGE_MANAGER_URL_IMAGE_ENABLED
 
-void AsynURL_ImageLoader(std::string url, std::string path, std::string id, bool CacheFile)
+void AsynURL_ImageLoader(std::string url, std::string path, HDecodedImage decoded, bool CacheFile)
 {
-	Asynchronouslist.push_back(id);
-	httplib::Client client(url); // 滻ΪʵʵURL
-
-	auto response = client.Get(path); // 滻Ϊʵʵͼ·
-	if (response) {
+	std::unique_ptr<httplib::Client> client = AcquireUrlClient(url, std::bind(AsynURL_ImageLoader, url, path, decoded, CacheFile), decoded.request);
+	if (!client)
+		return;  //Parked until the host has a free connection
+	auto response = client->Get(path); // 滻Ϊʵʵͼ·
+	if (response && !HImageThreadPool::TaskExpired()) {
 		// Ӧлȡͼ
 		std::vector<unsigned char> imageData(response->body.begin(), response->body.end());
 
 		if (CacheFile)
 		{
-			std::ofstream file(std::string(IO.url_image_cache_files_path).append("\\").append(id), std::ios::binary);
+			std::ofstream file(std::string(IO.url_image_cache_files_path).append("\\").append(decoded.id), std::ios::binary);
 			if (file.good())
 			{
 				file.write(response->body.data(), response->body.size());
 				file.close();
 			}
 		}
-		HTexture t;
-
-		t.texture_data = stbi_load_from_memory(imageData.data(), imageData.size(), &t.width, &t.height, &t.channel, 4);
+		DecodeStaticImage(imageData.data(), imageData.size(), 0, !decoded.load, decoded.texture, decoded.source, &decoded.content_key);
 		response->body.clear();
 		imageData.clear();
-		client.stop();
-		Asyn_url_waitingloader_lists[id] = t;
-	}
-	else
-	{
-		HTexture t;
-		t.channel = -1;
-		Asyn_url_waitingloader_lists[id] = t;
-	}
-	std::this_thread::sleep_for(std::chrono::milliseconds(500));
-	if (Asyn_url_waitingloader_lists.count(id) > 0)
-	{
-		for (size_t i = 0; i < Asynchronouslist.size(); i++)
-		{
-			if (Asynchronouslist[i] == id)
-				Asynchronouslist.erase(Asynchronouslist.begin() + i);
-		}
-		Asyn_url_waitingloader_lists.erase(id);
 	}
+	ReleaseUrlClient(url, std::move(client), (bool)response);
+	PushDecodedImage(decoded);
 }
 
 #endif // HIMAGE_MANAGER_URL_IMAGE_ENABLED
 
 HTextureID HImageManager::ImageLoader::StaticImageLoader(const char* filename, CreateTextureCallback load)
 {
-	int w, h, c;
-	unsigned char* data = stbi_load(filename, &w, &h, &c, 4);
-	if (data == NULL)
+	HTexture t;
+	std::shared_ptr<HFileSource> source;
+	if (!DecodeStaticImageFile(filename, 0, !load, t, source))
 	{
 		printf("\n Error : Load Image %s", filename);
 		return 0;
 	}
-	if (load)
-		StaticImages.push_back(load(data, w, h, c));
-	else
-		StaticImages.push_back(IO.CreateTexture(data, w, h, c));
+	StaticImages.push_back(CreateTexture(t, load ? load : IO.CreateTexture));
 
-	stbi_image_free(data);
+	FreeStaticImage(t, source);
 	return StaticImages.back();
 }
 
@@ -343,73 +2849,237 @@ void HImageManager::ImageLoader::DeleteStaticImage(HTextureID texture, DeleteTex
 	}
 }
 
-bool HImageManager::ImageLoader::GetImage(HBitImage& bit_image, size_t& bit_image_size, HImage*& image_out, float life_cycle, CreateTextureCallback load, DeleteTextureCallback unload)
+//data is only read on a cache miss, the entry is named after id_address in ShowResourceManager
+bool GetImageFromMemory(uint64_t key, const unsigned char* data, size_t size, const void* id_address, HImage*& image_out, float life_cycle, CreateTextureCallback load, DeleteTextureCallback unload)
 {
-	std::string name = std::to_string((long long)&bit_image);
-	if (hashMap.count(name) > 0) {
-		HImageInfo& info = hashMap[name];
+	auto found = hashMap.find(key);
+	if (found != hashMap.end()) {
+		HImageInfo& info = found->second;
 		image_out = &info.image;
-		info.life_cycle = life_cycle;
+		TouchCacheEntry(info, life_cycle);
+		return info.image.texture != 0;
 	}
 	else
 	{
 		HImageInfo info;
+		info.id = std::to_string((long long)id_address);
 		info.life_cycle = life_cycle;
 		bool r;
 		if (load && unload)
 		{
 			info.unload = unload;
-			r = GetHTextureFormFile(bit_image, bit_image_size, info, load);
+			r = GetHTextureFormMemory(data, size, info, load);
 		}
 		else
 		{
-			r = GetHTextureFormFile(bit_image, bit_image_size, info, IO.CreateTexture);
+			r = GetHTextureFormMemory(data, size, info, IO.CreateTexture);
 		}
-		hashMap[name] = info;
-		image_out = &info.image;
-		return r && &info.image;
+		HImageInfo& stored = hashMap[key] = info;
+		InsertCacheEntry(HImageKind_Image, key, stored);
+		image_out = &stored.image;
+		return r;
 	}
 }
 
-bool HImageManager::ImageLoader::GetImage(const char* filename, HImage*& image_out, float life_cycle, CreateTextureCallback load, DeleteTextureCallback unload)
+bool HImageManager::ImageLoader::GetImage(HBitImage& bit_image, size_t& bit_image_size, HImage*& image_out, float life_cycle, CreateTextureCallback load, DeleteTextureCallback unload)
+{
+	return GetImageFromMemory(HashImageKey(bit_image, bit_image_size), bit_image.data(), bit_image_size, &bit_image, image_out, life_cycle, load, unload);
+}
+
+bool HImageManager::ImageLoader::GetImage(const void* data, size_t size, uint64_t key, HImage*& image_out, float life_cycle, CreateTextureCallback load, DeleteTextureCallback unload)
+{
+	return GetImageFromMemory(HashImageKey(data, size, key), (const unsigned char*)data, size, data, image_out, life_cycle, load, unload);
+}
+
+HImageHandle HImageManager::ImageLoader::GetHandle(const void* data, size_t size)
+{
+	HImageHandle handle;
+	handle.key = HashImageKey(data, size, 0);
+	return handle;
+}
+
+bool HImageManager::ImageLoader::GetImage(const void* data, size_t size, HImageHandle handle, HImage*& image_out, float life_cycle, CreateTextureCallback load, DeleteTextureCallback unload)
+{
+	return GetImageFromMemory(handle.key, (const unsigned char*)data, size, data, image_out, life_cycle, load, unload);
+}
+
+const int HImageMaxLodSize = 8192;
+
+//IO.DecodeToDisplaySize : the power of two covering the drawn size (0 : full resolution)
+int LodSize(const ImVec2& display_size)
+{
+	float side = std::max(display_size.x, display_size.y);
+	if (!IO.DecodeToDisplaySize || side <= 0)
+		return 0;
+	int size = 16;
+	while (size < side)
+	{
+		size *= 2;
+		if (size > HImageMaxLodSize)
+			return 0;
+	}
+	return size;
+}
+
+//Every level of a file is cached under its own key, level 0 keeps the file key so handles and plain lookups share it
+inline uint64_t LodKey(uint64_t key, int lod_size)
+{
+	return lod_size ? key ^ ((uint64_t)lod_size * 0x9e3779b97f4a7c15ull) : key;
+}
+
+std::shared_ptr<HLoadRequest> SubmitImageLoad(uint64_t lod_key, const char* filename, int lod_size, float life_cycle, CreateTextureCallback load, DeleteTextureCallback unload)
+{
+	HDecodedImage decoded;
+	decoded.key = lod_key;
+	decoded.id = filename;
+	decoded.kind = HImageKind_Image;
+	decoded.lod_size = lod_size;
+	decoded.life_cycle = life_cycle;
+	decoded.load = load;
+	decoded.unload = unload;
+	decoded.request = AddLoadRequest(lod_key, decoded.id);
+	ThreadPool.Submit(std::bind(AsynchronousProcessingImage, decoded), decoded.request);
+	return decoded.request;
+}
+
+//filename is only read on a cache miss, 0 looks it up from the handle names
+bool GetImageByKey(uint64_t key, const char* filename, HImage*& image_out, float life_cycle, CreateTextureCallback load, DeleteTextureCallback unload, int lod_size = 0)
 {
-	if (hashMap.count(filename) > 0) {
-		HImageInfo& info = hashMap[filename];
+	uint64_t lod_key = LodKey(key, lod_size);
+	auto found = hashMap.find(lod_key);
+	if (found != hashMap.end()) {
+		HImageInfo& info = found->second;
 		image_out = &info.image;
-		info.life_cycle = life_cycle;
+		TouchCacheEntry(info, life_cycle);
+		return info.image.texture != 0;
+	}
+
+	if (!filename)
+		filename = HandleName(key);
+	if (!filename)
+	{
+		image_out = 0;
+		return false;
+	}
+	else if (IO.AsynchronousStaticImage)
+	{
+		//Until the level is decoded, draw a larger one if it is cached
+		image_out = 0;
+		for (int size = lod_size; size != 0;)
+		{
+			size = size * 2 > HImageMaxLodSize ? 0 : size * 2;
+			auto larger = hashMap.find(LodKey(key, size));
+			if (larger != hashMap.end() && larger->second.image.texture)
+			{
+				TouchCacheEntry(larger->second, life_cycle);
+				image_out = &larger->second.image;
+				break;
+			}
+		}
+		if (!TouchLoadRequest(lod_key))
+			SubmitImageLoad(lod_key, filename, lod_size, life_cycle, load, unload);
+		return image_out != 0;
 	}
 	else
 	{
 		HImageInfo info;
+		info.id = filename;
 		info.life_cycle = life_cycle;
 		bool r;
 		if (load && unload)
 		{
 			info.unload = unload;
-			r = GetHTextureFormFile(filename, info, load);
+			r = GetHTextureFormFile(filename, info, load, lod_size);
 		}
 		else
 		{
-			r = GetHTextureFormFile(filename, info, IO.CreateTexture);
+			r = GetHTextureFormFile(filename, info, IO.CreateTexture, lod_size);
 		}
-		hashMap[filename] = info;
-		image_out = &info.image;
-		return r && &info.image;
+		if (lod_size)
+			info.id.append(" @").append(std::to_string(lod_size));
+		HImageInfo& stored = hashMap[lod_key] = info;
+		InsertCacheEntry(HImageKind_Image, lod_key, stored);
+		image_out = &stored.image;
+		return r;
 	}
 }
 
+bool HImageManager::ImageLoader::GetImage(const char* filename, HImage*& image_out, float life_cycle, CreateTextureCallback load, DeleteTextureCallback unload)
+{
+	return GetImageByKey(HashImageKey(filename), filename, image_out, life_cycle, load, unload);
+}
+
+HImageHandle HImageManager::ImageLoader::GetHandle(const char* filename)
+{
+	HImageHandle handle;
+	handle.key = HashImageKey(filename);
+	if (HandleNames.count(handle.key) == 0)
+		HandleNames[handle.key] = filename;
+	return handle;
+}
+
+HImageRef HImageManager::ImageLoader::GetImageRef(HImageHandle handle)
+{
+	return hashMap.Ref(handle.key);
+}
+
+HImage* HImageManager::ImageLoader::GetImage(HImageRef ref, float life_cycle)
+{
+	HImageInfo* info = hashMap.Find(ref);
+	if (!info)
+		return 0;
+	TouchCacheEntry(*info, life_cycle);
+	return &info->image;
+}
+
+bool HImageManager::ImageLoader::GetImage(HImageHandle handle, HImage*& image_out, float life_cycle, CreateTextureCallback load, DeleteTextureCallback unload)
+{
+	return GetImageByKey(handle.key, 0, image_out, life_cycle, load, unload);
+}
+
+bool HImageManager::ImageLoader::GetImage(const char* filename, const ImVec2& display_size, HImage*& image_out, float life_cycle, CreateTextureCallback load, DeleteTextureCallback unload)
+{
+	return GetImageByKey(HashImageKey(filename), filename, image_out, life_cycle, load, unload, LodSize(display_size));
+}
+
+bool HImageManager::ImageLoader::GetImage(HImageHandle handle, const ImVec2& display_size, HImage*& image_out, float life_cycle, CreateTextureCallback load, DeleteTextureCallback unload)
+{
+	return GetImageByKey(handle.key, 0, image_out, life_cycle, load, unload, LodSize(display_size));
+}
+
+void HImageManager::DrawList::AddImage(ImDrawList* draw_list, const char* filename, const ImVec2& p_min, const ImVec2& p_max, float life_cycle, const ImVec2& uv_min, const ImVec2& uv_max, ImU32 col, CreateTextureCallback load, DeleteTextureCallback unload, HImageManagerIO::DrawLoadingCallback draw_loading)
+{
+	HImage* image = 0;
+	if (HImageManager::ImageLoader::GetImage(filename, p_max - p_min, image, life_cycle, load, unload))
+		draw_list->AddImage(image->texture, p_min, p_max, image->UV(uv_min), image->UV(uv_max), col);
+	else
+		DrawLoadingImage(draw_list, p_min, p_max, 0, draw_loading);
+}
+
+void HImageManager::DrawList::AddImageRounded(ImDrawList* draw_list, const char* filename, const ImVec2& p_min, const ImVec2& p_max, float rounding, float life_cycle, const ImVec2& uv_min, const ImVec2& uv_max, ImU32 col, ImDrawFlags flags, CreateTextureCallback load, DeleteTextureCallback unload, HImageManagerIO::DrawLoadingCallback draw_loading)
+{
+	HImage* image = 0;
+	if (HImageManager::ImageLoader::GetImage(filename, p_max - p_min, image, life_cycle, load, unload))
+		draw_list->AddImageRounded(image->texture, p_min, p_max, image->UV(uv_min), image->UV(uv_max), col, rounding, flags);
+	else
+		DrawLoadingImage(draw_list, p_min, p_max, rounding, draw_loading);
+}
+
 #if HIMAGE_MANAGER_URL_IMAGE_ENABLED
 bool HImageManager::ImageLoader::GetImage_url(const char* url, const char* path, const char* id, HImage*& image_out, bool CacheFile, float life_cycle, CreateTextureCallback load, DeleteTextureCallback unload)
 {
-	if (url_hashMap.count(id) > 0) {
-		HImageInfo& info = url_hashMap[id];
+	uint64_t key = HashImageKey(id);
+	auto found = url_hashMap.find(key);
+	if (found != url_hashMap.end()) {
+		HImageInfo& info = found->second;
 		image_out = &info.image;
-		info.life_cycle = life_cycle;
-		return true;
+		TouchCacheEntry(info, life_cycle);
+		return info.image.texture != 0;
 	}
 	else
 	{
 		HImageInfo info;
+		info.id = id;
 		info.life_cycle = life_cycle;
 		bool r;
 		if (CacheFile)
@@ -431,66 +3101,30 @@ bool HImageManager::ImageLoader::GetImage_url(const char* url, const char* path,
 					tb << std::chrono::system_clock::now().time_since_epoch().count();
 					tb.close();
 				}
-				url_hashMap[id] = info;
-				image_out = &info.image;
-				return r && &info.image;
+				HImageInfo& stored = url_hashMap[key] = info;
+				InsertCacheEntry(HImageKind_Url, key, stored);
+				image_out = &stored.image;
+				return true;
 			}
 		}
 
-		for (size_t i = 0; i < Asynchronouslist.size(); i++)
-		{
-			if (Asynchronouslist[i] == id)
-			{
-				if (Asyn_url_waitingloader_lists.count(id) > 0)
-				{
-					if (load && unload)
-					{
-						Asynchronouslist.erase(Asynchronouslist.begin() + i);
-						HTexture t = Asyn_url_waitingloader_lists[id];
-						Asyn_url_waitingloader_lists.erase(id);
-						if (t.channel)
-						{
-							info.image.SetInfo(t);
-							info.unload = unload;
-							info.image.texture = load(t.texture_data, t.width, t.height, t.channel);
-							stbi_image_free(t.texture_data);
-						}
-						else
-							return false;
-					}
-					else
-					{
-						Asynchronouslist.erase(Asynchronouslist.begin() + i);
-						HTexture t = Asyn_url_waitingloader_lists[id];
-						Asyn_url_waitingloader_lists.erase(id);
-						if (t.channel)
-						{
-							info.image.SetInfo(t);
-							info.image.texture = IO.CreateTexture(t.texture_data, t.width, t.height, t.channel);
-							stbi_image_free(t.texture_data);
-						}
-						else
-							return false;
-					}
+		image_out = 0;
+		if (TouchLoadRequest(key))
+			return false;
 
-					url_hashMap[id] = info;
-					image_out = &info.image;
-					return r && &info.image;
-				}
-				else
-				{
-					return false;
-				}
-			}
-		}
-		std::thread t(AsynURL_ImageLoader, url, path, id, CacheFile);
-		t.detach();
+		HDecodedImage decoded;
+		decoded.key = key;
+		decoded.id = id;
+		decoded.kind = HImageKind_Url;
+		decoded.life_cycle = life_cycle;
+		decoded.load = load;
+		decoded.unload = unload;
+		decoded.request = AddLoadRequest(key, decoded.id);
+		ThreadPool.Submit(std::bind(AsynURL_ImageLoader, std::string(url), std::string(path), decoded, CacheFile), decoded.request);
 		return false;
 	}
-	return false;
 }
 #endif // HIMAGE_MANAGER_URL_IMAGE_ENABLED
-#if HIMAGE_MANAGER_GIF_IMAGE_ENABLED || HIMAGE_MANAGER_URL_IMAGE_ENABLED
 void Draw_Loading::Draw_Loading_Style_1(const ImVec2& pos, float radius)
 {
 	ImGuiStyle* style = &ImGui::GetStyle();
@@ -513,111 +3147,122 @@ void Draw_Loading::Draw_Loading_Style_1(const ImVec2& pos, float radius)
 
 	DrawList->PathStroke(ImGui::GetColorU32(ImGuiCol_FrameBgHovered), false, 16);
 }
-#endif
 
 #if HIMAGE_MANAGER_GIF_IMAGE_ENABLED
 void AsynchronousProcessingGIF(AsynchronousGIF_info AsynInfo)
 {
-	HImageInfo_gif info;
-	info.life_cycle = AsynInfo.life_cycle;
-
-	if (AsynInfo.load && AsynInfo.unload)
-	{
-		info.unload = AsynInfo.unload;
-		GetHTextureFormFile(AsynInfo.filename, info);
-	}
-	else
-	{
-		GetHTextureFormFile(AsynInfo.filename, info);
-	}
-	GifUpdata(info, AsynInfo.speed, AsynInfo.load, AsynInfo.unload);
-	gif_hashMap[AsynInfo.filename] = info;
-	*AsynInfo.image_out = &info.image;
-	for (size_t i = 0; i < Asynchronouslist.size(); i++)
-	{
-		if (Asynchronouslist[i] == AsynInfo.filename)
-			Asynchronouslist.erase(Asynchronouslist.begin() + i);
-	}
+	HDecodedImage decoded;
+	decoded.id = AsynInfo.filename;
+	decoded.kind = HImageKind_Gif;
+	decoded.life_cycle = AsynInfo.life_cycle;
+	decoded.load = AsynInfo.load;
+	decoded.unload = AsynInfo.unload;
+	decoded.request = AsynInfo.request;
+	decoded.key = AsynInfo.request->key;
+	GetHTextureFormFile(AsynInfo.filename.c_str(), decoded.gif);
+	PackGifAtlas(decoded.gif);
+	CompactGifFrames(decoded.gif);
+	PushDecodedImage(decoded);
 }
 
 void AsynchronousProcessingGIF_Bit(AsynchronousGIF_info_Bit AsynInfo)
 {
-	HImageInfo_gif info;
-	info.life_cycle = AsynInfo.life_cycle;
+	HDecodedImage decoded;
+	decoded.id = AsynInfo.request->id;
+	decoded.kind = HImageKind_Gif;
+	decoded.life_cycle = AsynInfo.life_cycle;
+	decoded.load = AsynInfo.load;
+	decoded.unload = AsynInfo.unload;
+	decoded.request = AsynInfo.request;
+	decoded.key = AsynInfo.request->key;
+	GetHTextureFormMemory(AsynInfo.bytes, decoded.gif);
+	PackGifAtlas(decoded.gif);
+	CompactGifFrames(decoded.gif);
+	PushDecodedImage(decoded);
+}
 
-	if (AsynInfo.load && AsynInfo.unload)
-	{
-		info.unload = AsynInfo.unload;
-		GetHTextureFormFile(AsynInfo.image, *AsynInfo.size, info);
-	}
-	else
-	{
-		GetHTextureFormFile(AsynInfo.image, *AsynInfo.size, info);
-	}
-	GifUpdata(info, AsynInfo.speed, AsynInfo.load, AsynInfo.unload);
-	std::string id = std::to_string((int)AsynInfo.image);
-	gif_hashMap[id] = info;
-	*AsynInfo.image_out = &info.image;
-	for (size_t i = 0; i < Asynchronouslist.size(); i++)
-	{
-		if (Asynchronouslist[i] == id)
-			Asynchronouslist.erase(Asynchronouslist.begin() + i);
-	}
+//filename is only read on a cache miss, 0 looks it up from the handle names
+std::shared_ptr<HLoadRequest> SubmitGifLoad(uint64_t key, const char* filename, float speed, float life_cycle, CreateTextureCallback load, DeleteTextureCallback unload)
+{
+	AsynchronousGIF_info AsynInfo(filename, speed, life_cycle, load, unload);
+	AsynInfo.request = AddLoadRequest(key, filename);
+	ThreadPool.Submit(std::bind(AsynchronousProcessingGIF, AsynInfo), AsynInfo.request);
+	return AsynInfo.request;
 }
 
-bool HImageManager::ImageLoader::GetImage_gif(const char* filename, HImage*& image_out, float speed, float life_cycle, CreateTextureCallback load, DeleteTextureCallback unload)
+bool GetImageByKey_gif(uint64_t key, const char* filename, HImage*& image_out, float speed, float life_cycle, CreateTextureCallback load, DeleteTextureCallback unload)
 {
-	if (gif_hashMap.count(filename) > 0) {
-		HImageInfo_gif& info = gif_hashMap[filename];
-		info.life_cycle = life_cycle;
-		GifUpdata(info, speed, load, unload);
+	auto found = gif_hashMap.find(key);
+	if (found != gif_hashMap.end()) {
+		HImageInfo_gif& info = found->second;
+		TouchCacheEntry(info, life_cycle);
+		SetGifPlayback(info, speed, load, unload);
 		image_out = &info.image;
-		return true;
+		return info.image.texture != 0;
 	}
 	else
 	{
-		for (size_t i = 0; i < Asynchronouslist.size(); i++)
-		{
-			if (Asynchronouslist[i] == filename)
-				return false;
-		}
-		Asynchronouslist.push_back(filename);
-		std::thread t(AsynchronousProcessingGIF, AsynchronousGIF_info(filename, &image_out, speed, life_cycle, load, unload));
-		t.detach();
+		if (!filename)
+			filename = HandleName(key);
+		if (!filename || TouchLoadRequest(key))
+			return false;
+		SubmitGifLoad(key, filename, speed, life_cycle, load, unload);
 		return false;
 	}
 }
 
-bool HImageManager::ImageLoader::GetImage_gif(HBitImage& bit_image, size_t& bit_image_size, HImage*& image_out, float speed, float life_cycle, CreateTextureCallback load, DeleteTextureCallback unload)
+bool HImageManager::ImageLoader::GetImage_gif(const char* filename, HImage*& image_out, float speed, float life_cycle, CreateTextureCallback load, DeleteTextureCallback unload)
+{
+	return GetImageByKey_gif(HashImageKey(filename), filename, image_out, speed, life_cycle, load, unload);
+}
+
+bool HImageManager::ImageLoader::GetImage_gif(HImageHandle handle, HImage*& image_out, float speed, float life_cycle, CreateTextureCallback load, DeleteTextureCallback unload)
+{
+	return GetImageByKey_gif(handle.key, 0, image_out, speed, life_cycle, load, unload);
+}
+
+bool GetImageFromMemory_gif(uint64_t key, const unsigned char* data, size_t size, const void* id_address, HImage*& image_out, float speed, float life_cycle, CreateTextureCallback load, DeleteTextureCallback unload)
 {
-	std::string id = std::to_string((int)&bit_image);
-	if (gif_hashMap.count(id) > 0) {
-		HImageInfo_gif& info = gif_hashMap[id];
-		info.life_cycle = life_cycle;
-		GifUpdata(info, speed, load, unload);
+	auto found = gif_hashMap.find(key);
+	if (found != gif_hashMap.end()) {
+		HImageInfo_gif& info = found->second;
+		TouchCacheEntry(info, life_cycle);
+		SetGifPlayback(info, speed, load, unload);
 		image_out = &info.image;
-		return true;
+		return info.image.texture != 0;
 	}
 	else
 	{
-		for (size_t i = 0; i < Asynchronouslist.size(); i++)
-		{
-			if (Asynchronouslist[i] == id)
-				return false;
-		}
-		Asynchronouslist.push_back(id);
-		std::thread t(AsynchronousProcessingGIF_Bit, AsynchronousGIF_info_Bit(bit_image, bit_image_size, &image_out, speed, life_cycle, load, unload));
-		t.detach();
+		if (TouchLoadRequest(key))
+			return false;
+		AsynchronousGIF_info_Bit AsynInfo(HFileSource::FromMemory(data, size), speed, life_cycle, load, unload);
+		AsynInfo.request = AddLoadRequest(key, std::to_string((long long)id_address));
+		ThreadPool.Submit(std::bind(AsynchronousProcessingGIF_Bit, AsynInfo), AsynInfo.request);
 		return false;
 	}
 }
 
+bool HImageManager::ImageLoader::GetImage_gif(HBitImage& bit_image, size_t& bit_image_size, HImage*& image_out, float speed, float life_cycle, CreateTextureCallback load, DeleteTextureCallback unload)
+{
+	return GetImageFromMemory_gif(HashImageKey(bit_image, bit_image_size), bit_image.data(), bit_image_size, &bit_image, image_out, speed, life_cycle, load, unload);
+}
+
+bool HImageManager::ImageLoader::GetImage_gif(const void* data, size_t size, uint64_t key, HImage*& image_out, float speed, float life_cycle, CreateTextureCallback load, DeleteTextureCallback unload)
+{
+	return GetImageFromMemory_gif(HashImageKey(data, size, key), (const unsigned char*)data, size, data, image_out, speed, life_cycle, load, unload);
+}
+
+bool HImageManager::ImageLoader::GetImage_gif(const void* data, size_t size, HImageHandle handle, HImage*& image_out, float speed, float life_cycle, CreateTextureCallback load, DeleteTextureCallback unload)
+{
+	return GetImageFromMemory_gif(handle.key, (const unsigned char*)data, size, data, image_out, speed, life_cycle, load, unload);
+}
+
 void HImageManager::DrawList::AddImage_gif(ImDrawList* draw_list, const char* filename, const ImVec2& p_min, const ImVec2& p_max, float speed, float life_cycle, const ImVec2& uv_min, const ImVec2& uv_max, ImU32 col, HImageManagerIO::DrawLoadingCallback draw_loading, CreateTextureCallback load, DeleteTextureCallback unload)
 {
-	HImage* image;
-	HImageManager::ImageLoader::GetImage_gif(filename, image, speed, life_cycle, load, unload);
-	if (image)
-		draw_list->AddImage(image->texture, p_min, p_max, uv_min, uv_max, col);
+	HImage* image = 0;
+	bool loaded = HImageManager::ImageLoader::GetImage_gif(filename, image, speed, life_cycle, load, unload);
+	if (loaded)
+		draw_list->AddImage(image->texture, p_min, p_max, image->UV(uv_min), image->UV(uv_max), col);
 	else
 	{
 		ImVec2 size = ImRect(p_min, p_max).GetSize();
@@ -634,9 +3279,9 @@ void HImageManager::DrawList::AddImage_gif(ImDrawList* draw_list, const char* fi
 void HImageManager::DrawList::AddImageRounded_gif(ImDrawList* draw_list, const char* filename, const ImVec2& p_min, const ImVec2& p_max, float rounding, float speed, float life_cycle, const ImVec2& uv_min, const ImVec2& uv_max, ImU32 col, ImDrawFlags flags, HImageManagerIO::DrawLoadingCallback draw_loading, CreateTextureCallback load, DeleteTextureCallback unload)
 {
 	HImage* image = 0;
-	HImageManager::ImageLoader::GetImage_gif(filename, image, speed, life_cycle, load, unload);
-	if (image)
-		draw_list->AddImageRounded(image->texture, p_min, p_max, uv_min, uv_max, col, rounding, flags);
+	bool loaded = HImageManager::ImageLoader::GetImage_gif(filename, image, speed, life_cycle, load, unload);
+	if (loaded)
+		draw_list->AddImageRounded(image->texture, p_min, p_max, image->UV(uv_min), image->UV(uv_max), col, rounding, flags);
 	else
 	{
 		ImVec2 size = ImRect(p_min, p_max).GetSize();
@@ -663,8 +3308,8 @@ void HImageManager::Image_gif(const char* filename, const ImVec2& size, float sp
 	if (!ImGui::ItemAdd(bb, 0))
 		return;
 	HImage* image = 0;
-	HImageManager::ImageLoader::GetImage_gif(filename, image, speed, life_cycle, load, unload);
-	if (!image)
+	bool loaded = HImageManager::ImageLoader::GetImage_gif(filename, image, speed, life_cycle, load, unload);
+	if (!loaded)
 	{
 		window->DrawList->AddRectFilled(bb.Min, bb.Max, ImGui::GetColorU32(ImGuiCol_FrameBg));
 
@@ -680,11 +3325,11 @@ void HImageManager::Image_gif(const char* filename, const ImVec2& size, float sp
 	if (border_col.w > 0.0f)
 	{
 		window->DrawList->AddRect(bb.Min, bb.Max, ImGui::GetColorU32(border_col), 0.0f);
-		window->DrawList->AddImage(image->texture, bb.Min + ImVec2(1, 1), bb.Max - ImVec2(1, 1), uv0, uv1, ImGui::GetColorU32(tint_col));
+		window->DrawList->AddImage(image->texture, bb.Min + ImVec2(1, 1), bb.Max - ImVec2(1, 1), image->UV(uv0), image->UV(uv1), ImGui::GetColorU32(tint_col));
 	}
 	else
 	{
-		window->DrawList->AddImage(image->texture, bb.Min, bb.Max, uv0, uv1, ImGui::GetColorU32(tint_col));
+		window->DrawList->AddImage(image->texture, bb.Min, bb.Max, image->UV(uv0), image->UV(uv1), ImGui::GetColorU32(tint_col));
 	}
 }
 
@@ -701,8 +3346,8 @@ void HImageManager::Image_gif(HBitImage& bit_image, size_t& bit_image_size, cons
 	if (!ImGui::ItemAdd(bb, 0))
 		return;
 	HImage* image = 0;
-	HImageManager::ImageLoader::GetImage_gif(bit_image, bit_image_size, image, speed, life_cycle, load, unload);
-	if (!image)
+	bool loaded = HImageManager::ImageLoader::GetImage_gif(bit_image, bit_image_size, image, speed, life_cycle, load, unload);
+	if (!loaded)
 	{
 		window->DrawList->AddRectFilled(bb.Min, bb.Max, ImGui::GetColorU32(ImGuiCol_FrameBg));
 
@@ -718,54 +3363,49 @@ void HImageManager::Image_gif(HBitImage& bit_image, size_t& bit_image_size, cons
 	if (border_col.w > 0.0f)
 	{
 		window->DrawList->AddRect(bb.Min, bb.Max, ImGui::GetColorU32(border_col), 0.0f);
-		window->DrawList->AddImage(image->texture, bb.Min + ImVec2(1, 1), bb.Max - ImVec2(1, 1), uv0, uv1, ImGui::GetColorU32(tint_col));
+		window->DrawList->AddImage(image->texture, bb.Min + ImVec2(1, 1), bb.Max - ImVec2(1, 1), image->UV(uv0), image->UV(uv1), ImGui::GetColorU32(tint_col));
 	}
 	else
 	{
-		window->DrawList->AddImage(image->texture, bb.Min, bb.Max, uv0, uv1, ImGui::GetColorU32(tint_col));
+		window->DrawList->AddImage(image->texture, bb.Min, bb.Max, image->UV(uv0), image->UV(uv1), ImGui::GetColorU32(tint_col));
 	}
 }
 
 #if HIMAGE_MANAGER_URL_IMAGE_ENABLED
 void AsynchronousProcessingURL_GIF(AsynchronousGIF_URL_info AsynInfo)
 {
-	HImageInfo_gif info;
-	info.life_cycle = AsynInfo.life_cycle;
-
-	if (AsynInfo.load && AsynInfo.unload)
-	{
-		info.unload = AsynInfo.unload;
-		GetHTextureFormURL(AsynInfo.url, AsynInfo.path, AsynInfo.id, AsynInfo.CacheFile, info);
-	}
-	else
-	{
-		GetHTextureFormURL(AsynInfo.url, AsynInfo.path, AsynInfo.id, AsynInfo.CacheFile, info);
-	}
-
-	GifUpdata(info, AsynInfo.speed, AsynInfo.load, AsynInfo.unload);
-
-	gif_url_hashMap[AsynInfo.id] = info;
-	*AsynInfo.image_out = &info.image;
-
-	for (size_t i = 0; i < Asynchronouslist.size(); i++)
-	{
-		if (Asynchronouslist[i] == AsynInfo.id)
-			Asynchronouslist.erase(Asynchronouslist.begin() + i);
-	}
-	return;
+	std::unique_ptr<httplib::Client> client = AcquireUrlClient(AsynInfo.url, std::bind(AsynchronousProcessingURL_GIF, AsynInfo), AsynInfo.request);
+	if (!client)
+		return;  //Parked until the host has a free connection
+	HDecodedImage decoded;
+	decoded.id = AsynInfo.id;
+	decoded.kind = HImageKind_UrlGif;
+	decoded.life_cycle = AsynInfo.life_cycle;
+	decoded.load = AsynInfo.load;
+	decoded.unload = AsynInfo.unload;
+	decoded.request = AsynInfo.request;
+	decoded.key = AsynInfo.request->key;
+	bool response = GetHTextureFormURL(*client, AsynInfo.path.c_str(), AsynInfo.id.c_str(), AsynInfo.CacheFile, decoded.gif);
+	ReleaseUrlClient(AsynInfo.url, std::move(client), response);
+	PackGifAtlas(decoded.gif);
+	CompactGifFrames(decoded.gif);
+	PushDecodedImage(decoded);
 }
 bool HImageManager::ImageLoader::GetImage_url_gif(const char* url, const char* path, const char* id, HImage*& image_out, float speed, bool CacheFile, float life_cycle, CreateTextureCallback load, DeleteTextureCallback unload)
 {
-	if (gif_url_hashMap.count(id) > 0) {
-		HImageInfo_gif& info = gif_url_hashMap[id];
-		info.life_cycle = life_cycle;
-		GifUpdata(info, speed, load, unload);
+	uint64_t key = HashImageKey(id);
+	auto found = gif_url_hashMap.find(key);
+	if (found != gif_url_hashMap.end()) {
+		HImageInfo_gif& info = found->second;
+		TouchCacheEntry(info, life_cycle);
+		SetGifPlayback(info, speed, load, unload);
 		image_out = &info.image;
-		return true;
+		return info.image.texture != 0;
 	}
 	else
 	{
 		HImageInfo_gif info;
+		info.id = id;
 		info.life_cycle = life_cycle;
 		bool r;
 		if (CacheFile)
@@ -787,20 +3427,22 @@ bool HImageManager::ImageLoader::GetImage_url_gif(const char* url, const char* p
 					tb << std::chrono::system_clock::now().time_since_epoch().count();
 					tb.close();
 				}
-				gif_url_hashMap[id] = info;
-				image_out = &info.image;
-				return r && &info.image;
+				PackGifAtlas(info);
+				CompactGifFrames(info);
+				HImageInfo_gif& stored = gif_url_hashMap[key] = info;
+				CreateGifTextures(stored, (load && unload) ? load : IO.CreateTexture);
+				InsertCacheEntry(HImageKind_UrlGif, key, stored, stored.CacheBytes());
+				SetGifPlayback(stored, speed, load, unload);
+				image_out = &stored.image;
+				return stored.image.texture != 0;
 			}
 		}
 
-		for (size_t i = 0; i < Asynchronouslist.size(); i++)
-		{
-			if (Asynchronouslist[i] == id)
-				return false;
-		}
-		Asynchronouslist.push_back(id);
-		std::thread t(AsynchronousProcessingURL_GIF, AsynchronousGIF_URL_info(id, url, path, CacheFile, &image_out, speed, life_cycle, load, unload));
-		t.detach();
+		if (TouchLoadRequest(key))
+			return false;
+		AsynchronousGIF_URL_info AsynInfo(id, url, path, CacheFile, speed, life_cycle, load, unload);
+		AsynInfo.request = AddLoadRequest(key, id);
+		ThreadPool.Submit(std::bind(AsynchronousProcessingURL_GIF, AsynInfo), AsynInfo.request);
 		return false;
 	}
 }
@@ -818,8 +3460,8 @@ void HImageManager::Image_url_gif(const char* url, const char* path, const char*
 		return;
 
 	HImage* image = 0;
-	HImageManager::ImageLoader::GetImage_url_gif(url, path, id, image, speed, CacheFile, life_cycle, load, unload);
-	if (!image)
+	bool loaded = HImageManager::ImageLoader::GetImage_url_gif(url, path, id, image, speed, CacheFile, life_cycle, load, unload);
+	if (!loaded)
 	{
 		window->DrawList->AddRect(bb.Min, bb.Max, ImGui::GetColorU32(ImGuiCol_FrameBg), rounding);
 
@@ -835,18 +3477,18 @@ void HImageManager::Image_url_gif(const char* url, const char* path, const char*
 	if (border_col.w > 0.0f)
 	{
 		window->DrawList->AddRect(bb.Min, bb.Max, ImGui::GetColorU32(border_col), rounding);
-		window->DrawList->AddImageRounded(image->texture, bb.Min + ImVec2(1, 1), bb.Max - ImVec2(1, 1), uv0, uv1, ImGui::GetColorU32(tint_col), rounding);
+		window->DrawList->AddImageRounded(image->texture, bb.Min + ImVec2(1, 1), bb.Max - ImVec2(1, 1), image->UV(uv0), image->UV(uv1), ImGui::GetColorU32(tint_col), rounding);
 	}
 	else
 	{
-		window->DrawList->AddImageRounded(image->texture, bb.Min, bb.Max, uv0, uv1, ImGui::GetColorU32(tint_col), rounding);
+		window->DrawList->AddImageRounded(image->texture, bb.Min, bb.Max, image->UV(uv0), image->UV(uv1), ImGui::GetColorU32(tint_col), rounding);
 	}
 }
 void HImageManager::DrawList::AddImage_url_gif(ImDrawList* draw_list, const char* url, const char* path, const char* id, const ImVec2& p_min, const ImVec2& p_max, float rounding, bool CacheFile, float speed, float life_cycle, const ImVec2& uv_min, const ImVec2& uv_max, ImU32 col, ImDrawFlags flags, HImageManagerIO::DrawLoadingCallback draw_loading, CreateTextureCallback load, DeleteTextureCallback unload)
 {
 	HImage* image = 0;
-	HImageManager::ImageLoader::GetImage_url_gif(url, path, id, image, speed, CacheFile, life_cycle, load, unload);
-	if (!image)
+	bool loaded = HImageManager::ImageLoader::GetImage_url_gif(url, path, id, image, speed, CacheFile, life_cycle, load, unload);
+	if (!loaded)
 	{
 		draw_list->AddRect(p_min, p_max, ImGui::GetColorU32(ImGuiCol_FrameBg), rounding);
 		ImVec2 size = ImRect(p_min, p_max).GetSize();
@@ -859,7 +3501,7 @@ void HImageManager::DrawList::AddImage_url_gif(ImDrawList* draw_list, const char
 		return;
 	}
 
-	draw_list->AddImageRounded(image->texture, p_min, p_max, uv_min, uv_max, col, rounding, flags);
+	draw_list->AddImageRounded(image->texture, p_min, p_max, image->UV(uv_min), image->UV(uv_max), col, rounding, flags);
 }
 #endif // HIMAGE_MANAGER_GIF_IMAGE_ENABLED
 #endif
@@ -868,10 +3510,10 @@ void HImageManager::DrawList::AddImage_url_gif(ImDrawList* draw_list, const char
 void HImageManager::DrawList::AddImage_url(ImDrawList* draw_list, const char* url, const char* path, const char* id, const ImVec2& p_min, const ImVec2& p_max, bool CacheFile, float life_cycle, const ImVec2& uv_min, const ImVec2& uv_max, ImU32 col, HImageManagerIO::DrawLoadingCallback draw_loading, CreateTextureCallback load, DeleteTextureCallback unload)
 {
 	HImage* image = 0;
-	HImageManager::ImageLoader::GetImage_url(url, path, id, image, CacheFile, life_cycle, load, unload);
-	if (image)
+	bool loaded = HImageManager::ImageLoader::GetImage_url(url, path, id, image, CacheFile, life_cycle, load, unload);
+	if (loaded)
 	{
-		draw_list->AddImage(image->texture, p_min, p_max, uv_min, uv_max, col);
+		draw_list->AddImage(image->texture, p_min, p_max, image->UV(uv_min), image->UV(uv_max), col);
 	}
 	else
 	{
@@ -889,10 +3531,10 @@ void HImageManager::DrawList::AddImage_url(ImDrawList* draw_list, const char* ur
 void HImageManager::DrawList::AddImageRounded_url(ImDrawList* draw_list, const char* url, const char* path, const char* id, const ImVec2& p_min, const ImVec2& p_max, float rounding, bool CacheFile, float life_cycle, const ImVec2& uv_min, const ImVec2& uv_max, ImU32 col, ImDrawFlags flags, HImageManagerIO::DrawLoadingCallback draw_loading, CreateTextureCallback load, DeleteTextureCallback unload)
 {
 	HImage* image = 0;
-	HImageManager::ImageLoader::GetImage_url(url, path, id, image, CacheFile, life_cycle, load, unload);
-	if (image)
+	bool loaded = HImageManager::ImageLoader::GetImage_url(url, path, id, image, CacheFile, life_cycle, load, unload);
+	if (loaded)
 	{
-		draw_list->AddImageRounded(image->texture, p_min, p_max, uv_min, uv_max, col, rounding);
+		draw_list->AddImageRounded(image->texture, p_min, p_max, image->UV(uv_min), image->UV(uv_max), col, rounding);
 	}
 	else
 	{
@@ -921,8 +3563,8 @@ void HImageManager::Image_url(const char* url, const char* path, const char* id,
 		return;
 
 	HImage* image = 0;
-	HImageManager::ImageLoader::GetImage_url(url, path, id, image, CacheFile, life_cycle, load, unload);
-	if (!image)
+	bool loaded = HImageManager::ImageLoader::GetImage_url(url, path, id, image, CacheFile, life_cycle, load, unload);
+	if (!loaded)
 	{
 		window->DrawList->AddRect(bb.Min, bb.Max, ImGui::GetColorU32(ImGuiCol_FrameBg), rounding);
 
@@ -937,11 +3579,11 @@ void HImageManager::Image_url(const char* url, const char* path, const char* id,
 	if (border_col.w > 0.0f)
 	{
 		window->DrawList->AddRect(bb.Min, bb.Max, ImGui::GetColorU32(border_col), rounding);
-		window->DrawList->AddImageRounded(image->texture, bb.Min + ImVec2(1, 1), bb.Max - ImVec2(1, 1), uv0, uv1, ImGui::GetColorU32(tint_col), rounding);
+		window->DrawList->AddImageRounded(image->texture, bb.Min + ImVec2(1, 1), bb.Max - ImVec2(1, 1), image->UV(uv0), image->UV(uv1), ImGui::GetColorU32(tint_col), rounding);
 	}
 	else
 	{
-		window->DrawList->AddImageRounded(image->texture, bb.Min, bb.Max, uv0, uv1, ImGui::GetColorU32(tint_col), rounding);
+		window->DrawList->AddImageRounded(image->texture, bb.Min, bb.Max, image->UV(uv0), image->UV(uv1), ImGui::GetColorU32(tint_col), rounding);
 	}
 }
 #if _HAS_CXX17
@@ -1050,12 +3692,20 @@ bool HImageManager::ImageButton_plus(const char* label, const char* Bace_ButtonI
 
 	// Render
 	HImage* image = 0;
-	HImageManager::ImageLoader::GetImage((held && hovered) ? Active_ButtonImageFileName : hovered ? Hovered_ButtonImageFileName : Bace_ButtonImageFileName, image, life_cycle, load, unload);
+	const char* state_filename = (held && hovered) ? Active_ButtonImageFileName : hovered ? Hovered_ButtonImageFileName : Bace_ButtonImageFileName;
+	bool loaded = HImageManager::ImageLoader::GetImage(state_filename, image, life_cycle, load, unload);
+	if (!loaded && state_filename != Bace_ButtonImageFileName)  //The base image while the hovered / active one is loading, so the button does not flicker
+		loaded = HImageManager::ImageLoader::GetImage(Bace_ButtonImageFileName, image, life_cycle, load, unload);
 
-	//const ImU32 col = ImGui::GetColorU32((held && hovered) ? ImGuiCol_ButtonActive : hovered ? ImGuiCol_ButtonHovered : ImGuiCol_Button);
 	ImGui::RenderNavHighlight(bb, id);
-	//ImGui::RenderFrame(bb.Min, bb.Max, col, true, style.FrameRounding);
-	window->DrawList->AddImageRounded(image->texture, bb.Min, bb.Max, ImVec2(0, 0), ImVec2(1, 1), ImColor(255, 255, 255), style.FrameRounding);
+	if (loaded)
+		window->DrawList->AddImageRounded(image->texture, bb.Min, bb.Max, image->UV(uv_min), image->UV(uv_max), ImColor(255, 255, 255), style.FrameRounding);
+	else
+	{
+		//Plain button frame until the base image is ready
+		const ImU32 col = ImGui::GetColorU32((held && hovered) ? ImGuiCol_ButtonActive : hovered ? ImGuiCol_ButtonHovered : ImGuiCol_Button);
+		ImGui::RenderFrame(bb.Min, bb.Max, col, true, style.FrameRounding);
+	}
 
 	if (g.LogEnabled)
 		ImGui::LogSetNextTextDecoration("[", "]");
@@ -1076,20 +3726,26 @@ void HImageManager::Image(HBitImage& bit_image, size_t& bit_image_size, const Im
 	ImGui::ItemSize(bb);
 	if (!ImGui::ItemAdd(bb, 0))
 		return;
-	HImage* image;
-	HImageManager::ImageLoader::GetImage(bit_image, bit_image_size, image, life_cycle, load, unload);
+	HImage* image = 0;
+	if (!HImageManager::ImageLoader::GetImage(bit_image, bit_image_size, image, life_cycle, load, unload))
+	{
+		window->DrawList->AddRectFilled(bb.Min, bb.Max, ImGui::GetColorU32(ImGuiCol_FrameBg), rounding);
+		return;
+	}
 
 	if (border_col.w > 0.0f)
 	{
 		window->DrawList->AddRect(bb.Min, bb.Max, ImGui::GetColorU32(border_col), rounding);
-		window->DrawList->AddImageRounded(image->texture, bb.Min + ImVec2(1, 1), bb.Max - ImVec2(1, 1), uv0, uv1, ImGui::GetColorU32(tint_col), rounding);
+		window->DrawList->AddImageRounded(image->texture, bb.Min + ImVec2(1, 1), bb.Max - ImVec2(1, 1), image->UV(uv0), image->UV(uv1), ImGui::GetColorU32(tint_col), rounding);
 	}
 	else
 	{
-		window->DrawList->AddImageRounded(image->texture, bb.Min, bb.Max, uv0, uv1, ImGui::GetColorU32(tint_col), rounding);
+		window->DrawList->AddImageRounded(image->texture, bb.Min, bb.Max, image->UV(uv0), image->UV(uv1), ImGui::GetColorU32(tint_col), rounding);
 	}
 }
-void HImageManager::Image(const char* filename, const ImVec2& size, float rounding, float life_cycle, const ImVec2& uv0, const ImVec2& uv1, const ImVec4& tint_col, const ImVec4& border_col, CreateTextureCallback load, DeleteTextureCallback unload)
+//Shared by the file name and handle versions of HImageManager::Image. The image is only requested once the item is visible
+template<typename GetImageFunc>
+void ImageWidget(GetImageFunc get_image, const ImVec2& size, float rounding, const ImVec2& uv0, const ImVec2& uv1, const ImVec4& tint_col, const ImVec4& border_col, HImageManagerIO::DrawLoadingCallback draw_loading)
 {
 	ImGuiWindow* window = ImGui::GetCurrentWindow();
 	if (window->SkipItems)
@@ -1101,107 +3757,459 @@ void HImageManager::Image(const char* filename, const ImVec2& size, float roundi
 	ImGui::ItemSize(bb);
 	if (!ImGui::ItemAdd(bb, 0))
 		return;
-	HImage* image;
-	HImageManager::ImageLoader::GetImage(filename, image, life_cycle, load, unload);
+	HImage* image = 0;
+	if (!get_image(image))
+	{
+		DrawLoadingImage(window->DrawList, bb.Min, bb.Max, rounding, draw_loading);
+		return;
+	}
 
 	if (border_col.w > 0.0f)
 	{
 		window->DrawList->AddRect(bb.Min, bb.Max, ImGui::GetColorU32(border_col), rounding);
-		window->DrawList->AddImageRounded(image->texture, bb.Min + ImVec2(1, 1), bb.Max - ImVec2(1, 1), uv0, uv1, ImGui::GetColorU32(tint_col), rounding);
+		window->DrawList->AddImageRounded(image->texture, bb.Min + ImVec2(1, 1), bb.Max - ImVec2(1, 1), image->UV(uv0), image->UV(uv1), ImGui::GetColorU32(tint_col), rounding);
 	}
 	else
 	{
-		window->DrawList->AddImageRounded(image->texture, bb.Min, bb.Max, uv0, uv1, ImGui::GetColorU32(tint_col), rounding);
+		window->DrawList->AddImageRounded(image->texture, bb.Min, bb.Max, image->UV(uv0), image->UV(uv1), ImGui::GetColorU32(tint_col), rounding);
 	}
 }
 
-void HImageManager::updata(float delta_time)
+void HImageManager::Image(const char* filename, const ImVec2& size, float rounding, float life_cycle, const ImVec2& uv0, const ImVec2& uv1, const ImVec4& tint_col, const ImVec4& border_col, CreateTextureCallback load, DeleteTextureCallback unload, HImageManagerIO::DrawLoadingCallback draw_loading)
 {
-#if HIMAGE_MANAGER_GIF_IMAGE_ENABLED
-	if (!gif_hashMap.empty())
+	ImageWidget([&](HImage*& image) { return HImageManager::ImageLoader::GetImage(filename, size, image, life_cycle, load, unload); }, size, rounding, uv0, uv1, tint_col, border_col, draw_loading);
+}
+
+void HImageManager::Image(HImageHandle handle, const ImVec2& size, float rounding, float life_cycle, const ImVec2& uv0, const ImVec2& uv1, const ImVec4& tint_col, const ImVec4& border_col, CreateTextureCallback load, DeleteTextureCallback unload, HImageManagerIO::DrawLoadingCallback draw_loading)
+{
+	ImageWidget([&](HImage*& image) { return HImageManager::ImageLoader::GetImage(handle, size, image, life_cycle, load, unload); }, size, rounding, uv0, uv1, tint_col, border_col, draw_loading);
+}
+
+struct HImagePreloadStatus
+{
+	int total = 0;
+	std::atomic<int> loaded{ 0 };
+	std::atomic<int> failed{ 0 };
+	std::promise<void> promise;
+	HImagePreloadHandle handle;  //Given to on_complete, its status is reset then so the status does not own itself
+	HImagePreloadOptions options;
+};
+
+//Preloads waiting for the upload of a key
+struct HPreloadWaiter
+{
+	int kind;
+	std::shared_ptr<HImagePreloadStatus> status;
+};
+std::unordered_multimap<uint64_t, HPreloadWaiter, HImageKeyHash> PreloadWaiters;
+
+void CompletePreload(const std::shared_ptr<HImagePreloadStatus>& status)
+{
+	status->promise.set_value();
+	HImagePreloadHandle handle = status->handle;
+	status->handle.status.reset();
+	if (status->options.on_complete)
+		status->options.on_complete(handle, status->options.user_data);
+}
+
+void CountPreloaded(const std::shared_ptr<HImagePreloadStatus>& status, bool loaded)
+{
+	if (!loaded)
+		status->failed++;
+	if (++status->loaded == status->total)
+		CompletePreload(status);
+}
+
+void NotifyPreloadWaiters(int kind, uint64_t key)
+{
+	auto range = PreloadWaiters.equal_range(key);
+	if (range.first == range.second)
+		return;
+	HCacheRef ref = { kind, key };
+	HImageInfo* info = FindCacheEntry(ref);
+	bool loaded = info && info->image.texture;
+	std::vector<std::shared_ptr<HImagePreloadStatus>> done;
+	for (auto iter = range.first; iter != range.second;)
 	{
-		auto iter = gif_hashMap.begin();
-		while (iter != gif_hashMap.end()) {
-			iter->second.life_cycle -= delta_time;
-			if (iter->second.life_cycle < 0)
-			{
-				if (iter->second.image.texture)
-				{
-					if (iter->second.unload)
-						iter->second.unload(iter->second.image.texture);
-					else
-						IO.DeleteTexture(iter->second.image.texture);
-				}
-				iter = gif_hashMap.erase(iter);
-			}
-			else
-				++iter;
+		if (iter->second.kind != kind)
+		{
+			++iter;
+			continue;
 		}
+		done.push_back(iter->second.status);
+		iter = PreloadWaiters.erase(iter);
 	}
-#endif
-#if HIMAGE_MANAGER_URL_IMAGE_ENABLED
-	if (!url_hashMap.empty())
+	for (auto& status : done)
+		CountPreloaded(status, loaded);
+}
+
+//Shutdown : the loads the preloads wait for were discarded
+void FailPreloadWaiters()
+{
+	std::vector<std::shared_ptr<HImagePreloadStatus>> failed;
+	for (auto& waiter : PreloadWaiters)
+		failed.push_back(waiter.second.status);
+	PreloadWaiters.clear();
+	for (auto& status : failed)
+		CountPreloaded(status, false);
+}
+
+HImagePreloadHandle HImageManager::Preload(const char* const* filenames, int count, const HImagePreloadOptions& options)
+{
+	std::shared_ptr<HImagePreloadStatus> status = std::make_shared<HImagePreloadStatus>();
+	status->total = std::max(count, 0);
+	status->options = options;
+	status->handle.status = status;
+	status->handle.future = status->promise.get_future().share();
+	HImagePreloadHandle handle = status->handle;
+	if (count <= 0)
 	{
-		auto iter = url_hashMap.begin();
-		while (iter != url_hashMap.end()) {
-			iter->second.life_cycle -= delta_time;
-			if (iter->second.life_cycle < 0)
-			{
-				if (iter->second.image.texture)
-				{
-					if (iter->second.unload)
-						iter->second.unload(iter->second.image.texture);
-					else
-						IO.DeleteTexture(iter->second.image.texture);
-				}
-				iter = url_hashMap.erase(iter);
-			}
+		CompletePreload(status);  //Nothing loaded, Progress is 1
+		return handle;
+	}
+
+	int lod_size = LodSize(options.display_size);
+	std::vector<HCacheRef> cached;
+	for (int i = 0; i < count; i++)
+	{
+		const char* filename = filenames[i];
+		bool gif = false;
+#if HIMAGE_MANAGER_GIF_IMAGE_ENABLED
+		gif = IsGifName(filename);
+#endif
+		HCacheRef ref = { gif ? HImageKind_Gif : HImageKind_Image, gif ? HashImageKey(filename) : LodKey(HashImageKey(filename), lod_size) };
+		if (HImageInfo* info = FindCacheEntry(ref))
+		{
+			TouchCacheEntry(*info, info->life_cycle);
+			cached.push_back(ref);
+			continue;
+		}
+
+		HPreloadWaiter waiter = { ref.kind, status };
+		PreloadWaiters.insert(std::make_pair(ref.key, waiter));
+		std::shared_ptr<HLoadRequest> request;
+		auto queued = Asynchronouslist.find(ref.key);
+		if (queued != Asynchronouslist.end() && !queued->second->cancelled)
+		{
+			request = queued->second;
+			request->min_life_cycle = std::max(request->min_life_cycle, options.life_cycle);
+		}
+		else
+		{
+#if HIMAGE_MANAGER_GIF_IMAGE_ENABLED
+			if (gif)
+				request = SubmitGifLoad(ref.key, filename, options.speed, options.life_cycle, options.load, options.unload);
 			else
-				++iter;
+#endif
+				request = SubmitImageLoad(ref.key, filename, lod_size, options.life_cycle, options.load, options.unload);
 		}
+		request->preload = true;
+	}
+	for (const HCacheRef& ref : cached)
+		CountPreloaded(status, FindCacheEntry(ref)->image.texture != 0);
+	return handle;
+}
+
+int HImagePreloadHandle::Total() const
+{
+	return status ? status->total : 0;
+}
+
+int HImagePreloadHandle::Loaded() const
+{
+	return status ? status->loaded.load() : 0;
+}
+
+int HImagePreloadHandle::Failed() const
+{
+	return status ? status->failed.load() : 0;
+}
+
+float HImagePreloadHandle::Progress() const
+{
+	return Total() > 0 ? (float)Loaded() / Total() : 1.0f;
+}
+
+bool HImagePreloadHandle::IsDone() const
+{
+	return Loaded() >= Total();
+}
+
+void UploadDecodedImage(HDecodedImage& decoded)
+{
+	//Cancelled while it was already decoding, the image may have been asked for again under a new request
+	if (decoded.request && decoded.request->cancelled)
+	{
+		decoded.Release();
+		return;
+	}
+	if (decoded.request)
+		decoded.life_cycle = std::max(decoded.life_cycle, decoded.request->min_life_cycle);
+
+	CreateTextureCallback create = IO.CreateTexture;
+	DeleteTextureCallback unload = 0;
+	if (decoded.load && decoded.unload)
+	{
+		create = decoded.load;
+		unload = decoded.unload;
 	}
+
+	//Failed loads are cached too (texture 0), so they are not retried until the life cycle runs out
 #if HIMAGE_MANAGER_GIF_IMAGE_ENABLED
-	if (!gif_url_hashMap.empty())
+	if (decoded.IsGif())
+	{
+#if HIMAGE_MANAGER_URL_IMAGE_ENABLED
+		auto& map = decoded.kind == HImageKind_UrlGif ? gif_url_hashMap : gif_hashMap;
+#else
+		auto& map = gif_hashMap;
+#endif
+		if (map.count(decoded.key) > 0)
+		{
+			decoded.Release();
+		}
+		else
+		{
+			HImageInfo_gif& info = map[decoded.key] = decoded.gif;
+			info.id = decoded.id;
+			info.life_cycle = decoded.life_cycle;
+			info.unload = unload;
+			CreateGifTextures(info, create);
+			InsertCacheEntry(decoded.kind, decoded.key, info, info.CacheBytes());
+		}
+	}
+	else
+#endif // HIMAGE_MANAGER_GIF_IMAGE_ENABLED
 	{
-		auto iter = gif_url_hashMap.begin();
-		while (iter != gif_url_hashMap.end()) {
-			iter->second.life_cycle -= delta_time;
-			if (iter->second.life_cycle < 0)
+#if HIMAGE_MANAGER_URL_IMAGE_ENABLED
+		auto& map = decoded.kind == HImageKind_Url ? url_hashMap : hashMap;
+#else
+		auto& map = hashMap;
+#endif
+		if (map.count(decoded.key) == 0)
+		{
+			HImageInfo& info = map[decoded.key];
+			info.id = decoded.id;
+			if (decoded.lod_size)
+				info.id.append(" @").append(std::to_string(decoded.lod_size));
+			info.life_cycle = decoded.life_cycle;
+			info.unload = unload;
+			HTexture& t = decoded.texture;
+			if (t.texture_data || decoded.content_key)
 			{
-				if (iter->second.image.texture)
-				{
-					if (iter->second.unload)
-						iter->second.unload(iter->second.image.texture);
-					else
-						IO.DeleteTexture(iter->second.image.texture);
-				}
-				stbi_image_free(iter->second.data);
-				iter = gif_url_hashMap.erase(iter);
+				CreateStaticTexture(info, t, create, decoded.content_key);
+				decoded.content_key = 0;  //The reference it held now belongs to the entry
 			}
-			else
-				++iter;
+			InsertCacheEntry(decoded.kind, decoded.key, info);
+		}
+		decoded.Release();
+	}
+
+	auto request = Asynchronouslist.find(decoded.key);
+	if (request != Asynchronouslist.end() && request->second == decoded.request)
+		Asynchronouslist.erase(request);
+	NotifyPreloadWaiters(decoded.kind, decoded.key);
+}
+
+//budgeted false : uploads everything that is decoded (HImagePreloadHandle::Wait)
+void UploadPendingImages(bool budgeted = true)
+{
+	Asyn_decoded_lists.Drain([](HDecodedImage& decoded)
+		{
+			UploadQueueBytes += decoded.UploadBytes();
+			UploadQueue.push_back(decoded);
+		});
+
+	UploadStats.Uploaded = 0;
+	UploadStats.UploadedBytes = 0;
+	UploadStats.UploadMicroseconds = 0;
+	auto start = std::chrono::steady_clock::now();
+	while (!UploadQueue.empty())
+	{
+		HDecodedImage& decoded = UploadQueue.front();
+		size_t bytes = decoded.UploadBytes();
+		if (budgeted && UploadStats.Uploaded > 0)
+		{
+			if (IO.UploadBudgetBytesPerFrame > 0 && UploadStats.UploadedBytes + bytes > IO.UploadBudgetBytesPerFrame)
+				break;
+			if (IO.UploadBudgetMicrosecondsPerFrame > 0 && UploadStats.UploadMicroseconds >= IO.UploadBudgetMicrosecondsPerFrame)
+				break;
 		}
+		UploadDecodedImage(decoded);
+		UploadQueue.pop_front();
+		UploadQueueBytes -= bytes;
+
+		UploadStats.Uploaded++;
+		UploadStats.UploadedBytes += bytes;
+		UploadStats.UploadMicroseconds = std::chrono::duration<float, std::micro>(std::chrono::steady_clock::now() - start).count();
+	}
+	UploadStats.Pending = (int)UploadQueue.size();
+	UploadStats.PendingBytes = UploadQueueBytes;
+}
+
+void HImagePreloadHandle::Wait() const
+{
+	while (!IsDone())
+	{
+		UploadPendingImages(false);
+		if (!IsDone())
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
 	}
+}
+
+//Under LRU / Clock only failed loads still expire, so they get retried
+inline bool LifeCycleExpires(const HImageInfo& info)
+{
+	return IO.EvictionPolicy == HImageEvictionPolicy_LifeCycle || !info.image.texture;
+}
 
+void EraseCacheEntry(const HCacheRef& ref)
+{
+#if HIMAGE_MANAGER_GIF_IMAGE_ENABLED
+	if (ref.kind == HImageKind_Gif || ref.kind == HImageKind_UrlGif)
+	{
+#if HIMAGE_MANAGER_URL_IMAGE_ENABLED
+		auto& map = ref.kind == HImageKind_UrlGif ? gif_url_hashMap : gif_hashMap;
+#else
+		auto& map = gif_hashMap;
+#endif
+		auto iter = map.find(ref.key);
+		ReleaseGifAtlas(iter->second);
+		ReleaseCacheEntry(iter->second);
+		stbi_image_free(iter->second.data);
+		stbi_image_free(iter->second.delays);
+		map.erase(iter);
+		return;
+	}
 #endif // HIMAGE_MANAGER_GIF_IMAGE_ENABLED
-#endif // HIMAGE_MANAGER_URL_IMAGE_ENABLED
+#if HIMAGE_MANAGER_URL_IMAGE_ENABLED
+	auto& map = ref.kind == HImageKind_Url ? url_hashMap : hashMap;
+#else
+	auto& map = hashMap;
+#endif
+	auto iter = map.find(ref.key);
+	ReleaseCacheEntry(iter->second);
+	map.erase(iter);
+}
+
+template<typename Map>
+inline HImageInfo* FindInMap(Map& map, uint64_t key)
+{
+	auto iter = map.find(key);
+	return iter == map.end() ? 0 : &iter->second;
+}
+
+HImageInfo* FindCacheEntry(const HCacheRef& ref)
+{
+	switch (ref.kind)
+	{
+#if HIMAGE_MANAGER_GIF_IMAGE_ENABLED
+	case HImageKind_Gif: return FindInMap(gif_hashMap, ref.key);
+#if HIMAGE_MANAGER_URL_IMAGE_ENABLED
+	case HImageKind_UrlGif: return FindInMap(gif_url_hashMap, ref.key);
+#endif
+#endif
+#if HIMAGE_MANAGER_URL_IMAGE_ENABLED
+	case HImageKind_Url: return FindInMap(url_hashMap, ref.key);
+#endif
+	default: return FindInMap(hashMap, ref.key);
+	}
+}
 
-	auto iter = hashMap.begin();
-	while (iter != hashMap.end()) {
-		iter->second.life_cycle -= delta_time;
-		if (iter->second.life_cycle < 0)
+inline float RemainingLifeCycle(const HImageInfo& info)
+{
+	return info.life_cycle - (float)(CacheTime - info.last_used_time);
+}
+
+//Only the deadlines that are due are looked at, entries drawn since are re-armed
+void ExpireCacheEntries()
+{
+	while (!ExpiryHeap.empty() && ExpiryHeap.top().time <= CacheTime)
+	{
+		HExpiry expiry = ExpiryHeap.top();
+		ExpiryHeap.pop();
+		HImageInfo* info = FindCacheEntry(expiry.ref);
+		if (!info || info->expiry_serial != expiry.serial)
+			continue;
+
+		double deadline = info->last_used_time + info->life_cycle;
+		if (deadline > CacheTime)
 		{
-			if (iter->second.unload)
-				iter->second.unload(iter->second.image.texture);
-			else
-				IO.DeleteTexture(iter->second.image.texture);
-			iter = hashMap.erase(iter);
+			expiry.time = deadline;
+			ExpiryHeap.push(expiry);
+		}
+		else if (!LifeCycleExpires(*info))
+		{
+			expiry.time = CacheTime + std::max(info->life_cycle, 1.0f);  //Kept by LRU / Clock, look again later in case the policy changes
+			ExpiryHeap.push(expiry);
 		}
 		else
-			++iter;
+			EraseCacheEntry(expiry.ref);
+	}
+}
+
+void EvictOverBudget()
+{
+	if (IO.EvictionPolicy == HImageEvictionPolicy_LifeCycle || IO.TextureMemoryBudgetBytes == 0)
+		return;
+
+	int frame = ImGui::GetFrameCount();
+	size_t steps = CacheOrder.size() * 2;  //Clock : every flag gets cleared within one lap
+	while (CacheBytes > IO.TextureMemoryBudgetBytes && !CacheOrder.empty() && steps-- > 0)
+	{
+		if (IO.EvictionPolicy == HImageEvictionPolicy_LRU)
+		{
+			HCacheRef ref = CacheOrder.front();
+			if (FindCacheEntry(ref)->last_used_frame == frame)
+				break;  //Everything left was drawn this frame
+			EraseCacheEntry(ref);
+		}
+		else
+		{
+			if (ClockHand == CacheOrder.end())
+				ClockHand = CacheOrder.begin();
+			HImageInfo* info = FindCacheEntry(*ClockHand);
+			if (info->referenced || info->last_used_frame == frame)
+			{
+				info->referenced = false;
+				++ClockHand;
+				continue;
+			}
+			EraseCacheEntry(*ClockHand);
+		}
 	}
 }
 
+void AnimateGifs()
+{
+#if HIMAGE_MANAGER_GIF_IMAGE_ENABLED
+	//Gifs nobody drew last frame are left alone, their position is worked out again when they are drawn
+	int frame = ImGui::GetFrameCount();
+	for (auto& gif : gif_hashMap)
+		if (frame - gif.second.last_used_frame <= 1)
+			GifUpdata(gif.second);
+#if HIMAGE_MANAGER_URL_IMAGE_ENABLED
+	for (auto& gif : gif_url_hashMap)
+		if (frame - gif.second.last_used_frame <= 1)
+			GifUpdata(gif.second);
+#endif
+#endif
+}
+
+void HImageManager::updata(float delta_time)
+{
+	CancelForgottenLoadRequests();
+#if HIMAGE_MANAGER_URL_IMAGE_ENABLED
+	ResumeParkedUrlLoads();
+#endif
+	UploadPendingImages();
+
+	CacheTime += delta_time;
+	AnimateGifs();
+	ExpireCacheEntries();
+	EvictOverBudget();
+	RepackAtlasPages();
+}
+
 bool ResourceManagerItem(const char* filename, HImageInfo& info, float Size = 90, ImGuiButtonFlags flags = 0)
 {
 	ImGuiWindow* window = ImGui::GetCurrentWindow();
@@ -1235,11 +4243,12 @@ bool ResourceManagerItem(const char* filename, HImageInfo& info, float Size = 90
 	ImGui::RenderNavHighlight(bb, id);
 	ImGui::RenderFrame(bb.Min, bb.Max, col, true, style.FrameRounding);
 
-	window->DrawList->AddImageRounded(info.image.texture, bb.Min, ImVec2(bb.Min.x + Size, bb.Max.y), ImVec2(0, 0), ImVec2(1, 1), ImColor(255, 255, 255, 255), 15);
+	window->DrawList->AddImageRounded(info.image.texture, bb.Min, ImVec2(bb.Min.x + Size, bb.Max.y), info.image.uv_min, info.image.uv_max, ImColor(255, 255, 255, 255), 15);
 	window->DrawList->AddText(ImVec2(bb.Min.x + Size + style.FramePadding.x, bb.Max.y - yoffset), ImGui::GetColorU32(ImGuiCol_Text), filename);
-	float s = ImGui::CalcTextSize(std::to_string(info.life_cycle).c_str(), NULL, true).x;
+	std::string life_cycle = std::to_string(RemainingLifeCycle(info));
+	float s = ImGui::CalcTextSize(life_cycle.c_str(), NULL, true).x;
 
-	window->DrawList->AddText(ImVec2(bb.Max.x - (s + 15), bb.Max.y - yoffset), ImColor(235, 140, 52), std::to_string(info.life_cycle).c_str());
+	window->DrawList->AddText(ImVec2(bb.Max.x - (s + 15), bb.Max.y - yoffset), ImColor(235, 140, 52), life_cycle.c_str());
 	//ImGui::RenderTextClipped(ImVec2(90, 0) + (bb.Min + style.FramePadding), ImVec2(90, 0) + (bb.Max - style.FramePadding), filename, NULL, &label_size, style.ButtonTextAlign, &bb);
 
 	return pressed;
@@ -1298,7 +4307,7 @@ void HImageManager::ShowResourceManager(bool* p_open)
 				ImGui::Text("url images :");
 				auto iter = url_hashMap.begin();
 				while (iter != url_hashMap.end()) {
-					ResourceManagerItem(iter->first.c_str(), iter->second, itemsize);
+					ResourceManagerItem(iter->second.id.c_str(), iter->second, itemsize);
 					if (ImGui::IsItemHovered())
 					{
 						ImGui::BeginTooltip();
@@ -1314,12 +4323,12 @@ void HImageManager::ShowResourceManager(bool* p_open)
 				ImGui::Text("url gif images :");
 				auto iter = gif_url_hashMap.begin();
 				while (iter != gif_url_hashMap.end()) {
-					ResourceManagerItem(iter->first.c_str(), iter->second, itemsize);
+					ResourceManagerItem(iter->second.id.c_str(), iter->second, itemsize);
 					if (ImGui::IsItemHovered())
 					{
 						ImGui::BeginTooltip();
-						ImGui::SliderInt("current_frame : %d", &iter->second.current_frame, 0, iter->second.frames);
-						ImGui::Text("delay_buffer : %f", iter->second.delay_buffer);
+						ImGui::Text("shown frame : %d", iter->second.shown_frame);
+						ImGui::Text("playing for : %.2f s", (float)(CacheTime - iter->second.start_time));
 						ImGui::Text("Max frames : %d", iter->second.frames);
 
 						ImGui::Text("Image Info :\nheight :%d\nwidth : %d\nchannel : %d", iter->second.image.height, iter->second.image.width, iter->second.image.channel);
@@ -1338,12 +4347,12 @@ void HImageManager::ShowResourceManager(bool* p_open)
 
 				auto giter = gif_hashMap.begin();
 				while (giter != gif_hashMap.end()) {
-					ResourceManagerItem(giter->first.c_str(), giter->second, itemsize);
+					ResourceManagerItem(giter->second.id.c_str(), giter->second, itemsize);
 					if (ImGui::IsItemHovered())
 					{
 						ImGui::BeginTooltip();
-						ImGui::SliderInt("current_frame : %d", &giter->second.current_frame, 0, giter->second.frames);
-						ImGui::Text("delay_buffer : %f", giter->second.delay_buffer);
+						ImGui::Text("shown frame : %d", giter->second.shown_frame);
+						ImGui::Text("playing for : %.2f s", (float)(CacheTime - giter->second.start_time));
 						ImGui::Text("Max frames : %d", giter->second.frames);
 
 						ImGui::Text("Image Info :\nheight :%d\nwidth : %d\nchannel : %d", giter->second.image.height, giter->second.image.width, giter->second.image.channel);
@@ -1358,7 +4367,7 @@ void HImageManager::ShowResourceManager(bool* p_open)
 				ImGui::Text("HImages :");
 				auto iter = hashMap.begin();
 				while (iter != hashMap.end()) {
-					ResourceManagerItem(iter->first.c_str(), iter->second, itemsize);
+					ResourceManagerItem(iter->second.id.c_str(), iter->second, itemsize);
 					if (ImGui::IsItemHovered())
 					{
 						ImGui::BeginTooltip();
@@ -1378,39 +4387,42 @@ void HImageManager::ShowResourceManager(bool* p_open)
 					HImageInfo info;
 					info.image.texture = texture;
 					info.life_cycle = -1;
+					info.last_used_time = CacheTime;
 					ResourceManagerItem(intToHex((long long)texture).c_str(), info, itemsize);
 				}
 			}
 		}
 		ImGui::EndChild();
-#if HIMAGE_MANAGER_GIF_IMAGE_ENABLED || HIMAGE_MANAGER_URL_IMAGE_ENABLED
+		ImGui::Text("cached : %.1f MB", CacheBytes / (1024.0f * 1024.0f));
+		if (IO.EvictionPolicy != HImageEvictionPolicy_LifeCycle && IO.TextureMemoryBudgetBytes > 0)
+		{
+			ImGui::SameLine();
+			ImGui::Text("/ %.1f MB", IO.TextureMemoryBudgetBytes / (1024.0f * 1024.0f));
+		}
 		ImGui::SeparatorText("Processing picture threads");
-		//Asyn_url_waitingloader_lists
-		for (size_t i = 0; i < Asynchronouslist.size(); i++)
+		HImageThreadPoolStats stats = ThreadPool.GetStats();
+		ImGui::Text("workers : %d  busy : %d  queued : %d  timed out : %d", stats.Workers, stats.BusyWorkers, stats.QueueDepth, stats.TimedOutTasks);
+		for (auto& request : Asynchronouslist)
 		{
-			ImGui::BulletText(Asynchronouslist[i].c_str());
+			ImGui::BulletText("%s (last asked for at frame %d)", request.second->id.c_str(), request.second->priority.load());
 		}
-		ImGui::SeparatorText("Asyn url image waiting loader list");
-#endif // 0
-#if HIMAGE_MANAGER_URL_IMAGE_ENABLED
-		auto iter = Asyn_url_waitingloader_lists.begin();
-		while (iter != Asyn_url_waitingloader_lists.end()) {
-			ImGui::BulletText(iter->first.c_str());
-			++iter;
+		ImGui::SeparatorText("Texture upload queue");
+		ImGui::Text("pending : %d (%.1f KB)  last frame : %d (%.1f KB, %.0f us)", UploadStats.Pending, UploadStats.PendingBytes / 1024.0f, UploadStats.Uploaded, UploadStats.UploadedBytes / 1024.0f, UploadStats.UploadMicroseconds);
+		for (size_t i = 0; i < UploadQueue.size(); i++)
+		{
+			ImGui::BulletText(UploadQueue[i].id.c_str());
 		}
-#endif // HIMAGE_MANAGER_URL_IMAGE_ENABLED
 	}
 	ImGui::End();
 }
 
 const char* HImageManager::ImageToBitCode_DevelopmentTool(const char* filename, bool print)
 {
-	FILE* f = stbi__fopen(filename, "rb");
-	if (!f)
+	std::shared_ptr<HFileSource> source = HFileSource::Open(filename);
+	if (!source)
 		return  "Unable to open file";
-	fseek(f, 0, SEEK_END);
-	int bufSize = ftell(f);
-	unsigned char* buf = (unsigned char*)malloc(sizeof(unsigned char) * bufSize);
+	size_t bufSize = source->size;
+	const unsigned char* buf = source->data;
 	std::stringstream buffer;
 	buffer << "size_t /*variable name*/_Size = " << bufSize;
 	buffer << ";\nHBitImage /*variable name*/ = {";
@@ -1418,8 +4430,6 @@ const char* HImageManager::ImageToBitCode_DevelopmentTool(const char* filename,
 		printf("\n\n\n---------------------------------------------------------------------------------------------------------------------------------------------------\n", buffer.str().c_str());
 	if (buf)
 	{
-		fseek(f, 0, SEEK_SET);
-		fread(buf, 1, bufSize, f);
 		if (print)
 		{
 			for (size_t i = 0; i < bufSize; i++)
@@ -1444,20 +4454,72 @@ const char* HImageManager::ImageToBitCode_DevelopmentTool(const char* filename,
 			}
 		}
 		buffer << "};";
-		free(buf);
-		buf = NULL;
-	}
-	else
-	{
-		printf("HImGuiImageManager ->ImageToBitCode_DevelopmentTool -> Error -> Out of memory");
 	}
-	fclose(f);
 
 	std::cout << buffer.str();
 	std::cout << "\n\n\n";
 	return buffer.str().c_str();
 }
 
+bool HImageManager::ImagePack_DevelopmentTool(const char* pack_path, const char* const* filenames, int count, const char* const* names)
+{
+	std::vector<std::shared_ptr<HFileSource>> files;
+	std::vector<HImagePackEntry> entries;
+	std::string name_block;
+	for (int i = 0; i < count; i++)
+	{
+		std::shared_ptr<HFileSource> file = HFileSource::Open(filenames[i]);
+		if (!file || file->size > INT_MAX)
+		{
+			printf("HImGuiImageManager ->ImagePack_DevelopmentTool -> Error -> Unable to open file %s", filenames[i]);
+			return false;
+		}
+		const char* name = names ? names[i] : filenames[i];
+		size_t length = strlen(name);
+		HImagePackEntry entry = {};
+		entry.name_hash = HashImageKey(name);
+		entry.size = file->size;
+		entry.name_offset = (uint32_t)name_block.size();
+		entry.name_length = (uint32_t)length;
+		if (!stbi_info_from_memory(file->data, (int)file->size, &entry.width, &entry.height, &entry.channel))
+			printf("HImGuiImageManager ->ImagePack_DevelopmentTool -> Warning -> %s is not an image stb_image reads", filenames[i]);
+		if (IsGifName(name))
+			entry.flags |= HImagePackFlag_Gif;
+		name_block.append(name, length);
+		files.push_back(file);
+		entries.push_back(entry);
+	}
+
+	HImagePackHeader header = { { 'H', 'I', 'P', 'K' }, HImagePackVersion, (uint32_t)count, (uint32_t)name_block.size() };
+	uint64_t offset = sizeof(header) + entries.size() * sizeof(HImagePackEntry) + name_block.size();
+	for (HImagePackEntry& entry : entries)
+	{
+		offset = (offset + 15) & ~(uint64_t)15;
+		entry.offset = offset;
+		offset += entry.size;
+	}
+
+	std::ofstream pack(pack_path, std::ios::binary);
+	if (!pack.good())
+	{
+		printf("HImGuiImageManager ->ImagePack_DevelopmentTool -> Error -> Unable to write %s", pack_path);
+		return false;
+	}
+	pack.write((const char*)&header, sizeof(header));
+	if (!entries.empty())
+		pack.write((const char*)entries.data(), entries.size() * sizeof(HImagePackEntry));
+	pack.write(name_block.data(), name_block.size());
+	uint64_t written = sizeof(header) + entries.size() * sizeof(HImagePackEntry) + name_block.size();
+	const char padding[16] = {};
+	for (size_t i = 0; i < entries.size(); i++)
+	{
+		pack.write(padding, (std::streamsize)(entries[i].offset - written));
+		pack.write((const char*)files[i]->data, files[i]->size);
+		written = entries[i].offset + entries[i].size;
+	}
+	return pack.good();
+}
+
 double HImageManagerIO::HGetFunctionRuningSpeed(void(*function)())
 {
 	auto start = std::chrono::high_resolution_clock::now();
@@ -4,10 +4,14 @@
 //  Copyright (c) 2024 HalfPeople. All rights reserved.
 //  MIT License
 //
+//  stb_image is compiled by HImGuiImageManager.cpp (the gif streaming calls its internal decoder), do not define STB_IMAGE_IMPLEMENTATION in another file
+//
 #pragma once
 #include <stdio.h>
 #include <stdint.h>
 #include <vector>
+#include <memory>
+#include <future>
 #include "imgui.h"
 #ifndef HIMAGE_MANAGER_GIF_IMAGE_ENABLED
 #define HIMAGE_MANAGER_GIF_IMAGE_ENABLED 1    //If you do not want to use this function, please change it to '0'
@@ -22,13 +26,16 @@ struct HTexture
 {
 	int width, height, channel;
 	unsigned char* texture_data;
+	int format;  //fmt given to the texture callbacks, see HImageManagerIO::UploadFormats
 };
 struct HImage
 {
 	int width = 0, height = 0, channel = 0;
 	HTextureID texture = 0;
+	ImVec2 uv_min = ImVec2(0, 0), uv_max = ImVec2(1, 1);  //Part of the texture holding the image (gif frame atlas)
 
 	inline HTextureID GL_Texture() { return (void*)(long long)texture; }
+	inline ImVec2 UV(const ImVec2& uv) const { return ImVec2(uv_min.x + uv.x * (uv_max.x - uv_min.x), uv_min.y + uv.y * (uv_max.y - uv_min.y)); }
 	void SetInfo(int width_, int height_, int channel_, HTextureID texture_)
 	{
 		width = width_;
@@ -43,36 +50,150 @@ struct HImage
 		channel = htexture.channel;
 	}
 };
+//Precomputed cache key, see HImageManager::ImageLoader::GetHandle. Lookups with a handle do not hash or allocate
+struct HImageHandle
+{
+	uint64_t key = 0;
+
+	inline bool IsValid() const { return key != 0; }
+};
+//Slot of a cached static image, see HImageManager::ImageLoader::GetImageRef. Index and generation in 32 bits : it can be kept across frames and turns stale once the image is evicted, it never finds another image
+struct HImageRef
+{
+	uint32_t id = 0;
+
+	inline bool IsValid() const { return id != 0; }
+};
+//fmt of static images once HImageManagerIO::UploadFormats is set (otherwise fmt is the channel count of the source and data is rgba)
+enum HImageFormat_
+{
+	HImageFormat_RGBA8 = 8,
+	HImageFormat_R8,                   //Gray, drawn as (r, r, r, 1)
+	HImageFormat_RG8,                  //Gray + alpha, drawn as (r, r, r, g)
+	HImageFormat_RGB565,               //Opaque, 16 bit pixels with red in the high bits
+	HImageFormat_RGBA8_Premultiplied,
+	HImageFormat_BC1,                  //Opaque, 8 bytes per 4x4 block, given to CreateCompressedTexture
+	HImageFormat_BC3,                  //Rgba, 16 bytes per 4x4 block, given to CreateCompressedTexture
+};
+#define HImageFormatFlag(fmt) (1 << ((fmt) - HImageFormat_RGBA8))
 typedef void* (*CreateTextureCallback)(uint8_t* data, int w, int h, char fmt);
 typedef void (*DeleteTextureCallback)(void* tex);
+typedef void* (*CreateCompressedTextureCallback)(uint8_t* blocks, size_t size, int w, int h, char fmt);  //Blocks cover (w + 3) / 4 x (h + 3) / 4, fmt is HImageFormat_BC1 or HImageFormat_BC3
+typedef void (*UpdateTextureCallback)(void* tex, uint8_t* data, int w, int h, char fmt, int x, int y, int rect_w, int rect_h);  //data is the whole w * h image, only the rect has to be uploaded
 typedef std::vector<unsigned char> HBitImage;
 typedef void* HTextureID;
 
-#if HIMAGE_MANAGER_GIF_IMAGE_ENABLED || HIMAGE_MANAGER_URL_IMAGE_ENABLED
 namespace Draw_Loading
 {
 	void Draw_Loading_Style_1(const ImVec2& pos, float radius);
 }
-#endif
+
+struct HImageThreadPoolStats
+{
+	int Workers = 0;
+	int BusyWorkers = 0;
+	int QueueDepth = 0;
+	int TimedOutTasks = 0;  //Tasks that ran longer than MaximumThreadExecutionTime_Seconds, their image is dropped and counts as a failed load
+	int CancelledTasks = 0; //Queued loads dropped because their image was no longer requested
+};
+
+struct HImageUploadQueueStats
+{
+	int Pending = 0;                //Decoded images waiting for their texture upload
+	size_t PendingBytes = 0;
+	int Uploaded = 0;               //Textures created by the last HImageManager::updata
+	size_t UploadedBytes = 0;
+	float UploadMicroseconds = 0;   //Time the last HImageManager::updata spent creating textures
+};
+
+//HIMAGE_MANAGER_URL_IMAGE_ENABLED, connections of the url client pool since it started
+struct HImageUrlPoolStats
+{
+	int Connections = 0;            //Open now, idle or in use
+	int ConnectionsOpened = 0;
+	int ConnectionsReused = 0;      //Url loads served by an idle keep-alive connection
+	int PeakConnectionsPerHost = 0; //Never above UrlMaxConnectionsPerHost while it is > 0
+	int ParkedLoads = 0;            //Waiting for a connection of their host, they hold no worker meanwhile
+};
+
+enum HImageEvictionPolicy_
+{
+	HImageEvictionPolicy_LifeCycle,  //An image is released once it has not been drawn for its life_cycle seconds
+	HImageEvictionPolicy_LRU,        //Images stay cached until TextureMemoryBudgetBytes is exceeded, then the least recently drawn go first
+	HImageEvictionPolicy_Clock,      //Like LRU, but a cache hit only sets a flag instead of reordering the list
+};
 
 struct HImageManagerIO
 {
-#if HIMAGE_MANAGER_GIF_IMAGE_ENABLED || HIMAGE_MANAGER_URL_IMAGE_ENABLED
 	typedef void (*DrawLoadingCallback)(const ImVec2& half_pos, float half_size);
-#endif // HIMAGE_MANAGER_GIF_IMAGE_ENABLED || HIMAGE_MANAGER_URL_IMAGE_ENABLED
 
 	CreateTextureCallback CreateTexture = 0;
 	DeleteTextureCallback DeleteTexture = 0;
+	UpdateTextureCallback UpdateTexture = 0;  //Optional. Gif frames are written into their texture instead of deleting and creating one per frame (only for textures made by CreateTexture)
+	int UploadFormats = 0;                    //HImageFormatFlag() of the formats the texture callbacks accept. Static images are converted on the worker to the smallest of them holding the image (0 : rgba with the source channel count as fmt). Gifs stay HImageFormat_RGBA8
+	CreateCompressedTextureCallback CreateCompressedTexture = 0;  //Optional. With HImageFormat_BC1 / BC3 in UploadFormats, static images loaded without a custom load callback are block compressed on the worker. Deleted with DeleteTexture
+	int CompressMinSize = 256;                //Images with both sides below this stay uncompressed
 #if HIMAGE_MANAGER_URL_IMAGE_ENABLED
 	const char* url_image_cache_files_path = ".";
 #endif // 0
-#if HIMAGE_MANAGER_GIF_IMAGE_ENABLED || HIMAGE_MANAGER_URL_IMAGE_ENABLED
 	DrawLoadingCallback DrawLoading = Draw_Loading::Draw_Loading_Style_1;
-	int MaximumThreadExecutionTime_Seconds = 5;
-	int ThreadPoolMaximumNuberOfThreads = -1;//std::thread::hardware_concurrency();
-#endif // HIMAGE_MANAGER_GIF_IMAGE_ENABLED || HIMAGE_MANAGER_URL_IMAGE_ENABLED
+	int MaximumThreadExecutionTime_Seconds = 5; //Per task time limit : decodes give up between stages once it is over, and late results are dropped as failed loads. Also the url connect/read timeout (<= 0 : no limit)
+	int UrlMaxConnectionsPerHost = 6;           //Keep-alive connections kept per scheme://host:port and shared by the url loads, the others are parked until one is free (<= 0 : a new connection per load)
+	int ThreadPoolMaximumNuberOfThreads = -1;   //Read when the pool starts (-1 : std::thread::hardware_concurrency())
+	bool AsynchronousStaticImage = false;       //Decode GetImage(filename) images on the thread pool, DrawLoading is drawn until they are ready
+	size_t UploadBudgetBytesPerFrame = 0;       //Texture bytes HImageManager::updata may upload per frame, the rest waits for the next frames (0 : no limit)
+	float UploadBudgetMicrosecondsPerFrame = 0; //Time HImageManager::updata may spend creating textures per frame (0 : no limit). At least one image is uploaded every frame
+	int LoadRequestCancelFrames = 120;          //A queued load that nobody asked for during this many frames is cancelled (<= 0 : never)
+	int EvictionPolicy = HImageEvictionPolicy_LifeCycle;
+	bool GifFrameAtlas = false;                 //Upload all frames of a gif into atlas pages when it loads, playing it only changes the uv
+	int GifAtlasMaxSize = 2048;                 //Side limit of an atlas page
+	int GifAtlasMaxPages = 2;                   //Gifs needing more pages, or pages over TextureMemoryBudgetBytes, fall back to uploading frame by frame. The pages count toward the budget
+	bool GifCompactFrames = false;              //Keep decoded gif frames as palette indices of the rectangle each one changes, expanded to rgba when shown (no frame atlas)
+	bool GifStreaming = false;                  //Keep gifs compressed and decode frames while they play instead of expanding every frame when they load (no frame atlas)
+	int GifStreamFramesAhead = 3;               //Decoded frames kept ready ahead of the one shown
+	const char* DecodedCacheDirectory = 0;      //Existing directory where decoded, converted static images are kept by content hash. Later loads of the same content map the file and upload it without decoding (0 : off)
+	int SmallImageAtlasMaxSide = 0;             //Static images with both sides at most this share atlas pages, so drawing them does not switch texture (0 : off). Needs UpdateTexture
+	int SmallImageAtlasSize = 1024;             //Side of an atlas page
+	int SmallImageAtlasMaxPages = 4;            //Small images that fit in no page get their own texture. A page (texture and cpu copy) counts toward TextureMemoryBudgetBytes and is freed once empty
+	bool DeduplicateContent = false;            //Static images decoded from identical bytes share one texture, whatever file, url or HBitImage they came from. It is deleted with the last entry using it. Not applied to custom load callbacks or atlas images
+	bool DecodeToDisplaySize = false;           //Image / DrawList::AddImage decode file images at the power of two level covering the drawn size, each level is cached on its own
+	size_t TextureMemoryBudgetBytes = 0;        //LRU / Clock : bytes of cached textures and decoded gif frames kept before evicting (0 : no limit). Images drawn this frame are never evicted
 
 	double HGetFunctionRuningSpeed(void(*function)());
+	HImageThreadPoolStats GetThreadPoolStats();
+	HImageUploadQueueStats GetUploadQueueStats();
+#if HIMAGE_MANAGER_URL_IMAGE_ENABLED
+	HImageUrlPoolStats GetUrlPoolStats();
+#endif
+	size_t GetCacheBytes();                     //Bytes of cached textures and decoded gif frames
+};
+
+struct HImagePreloadStatus;  //Defined in HImGuiImageManager.cpp
+//Progress of a HImageManager::Preload, copies follow the same preload
+struct HImagePreloadHandle
+{
+	std::shared_ptr<HImagePreloadStatus> status;
+	std::shared_future<void> future;  //Ready once every image is uploaded, by HImageManager::updata or Wait
+
+	int Total() const;
+	int Loaded() const;  //Including the failed ones
+	int Failed() const;
+	float Progress() const;
+	bool IsDone() const;
+	void Wait() const;   //Uploads on the calling thread until done, so call it where HImageManager::updata is called
+};
+
+struct HImagePreloadOptions
+{
+	typedef void (*CompleteCallback)(const HImagePreloadHandle& handle, void* user_data);
+
+	float life_cycle = 60;                 //Cache time before the first draw, drawing then applies its own life_cycle. Also extends loads already queued by a draw
+	float speed = 1000;                    //Gifs
+	ImVec2 display_size = ImVec2(0, 0);    //With IO.DecodeToDisplaySize, the size the images will be drawn at
+	CreateTextureCallback load = 0;
+	DeleteTextureCallback unload = 0;
+	CompleteCallback on_complete = 0;      //Called by the thread uploading the last image
+	void* user_data = 0;
 };
 
 namespace HImageManager
@@ -82,12 +203,28 @@ namespace HImageManager
 	{
 		HTextureID StaticImageLoader(const char* filename, CreateTextureCallback load = 0);
 		void DeleteStaticImage(HTextureID texture, DeleteTextureCallback unload = 0);
-		bool GetImage(HBitImage& bit_image, size_t& bit_image_size, HImage*& image_out, float life_cycle = 1.5, CreateTextureCallback load = 0, DeleteTextureCallback unload = 0);
+		bool OpenImagePack(const char* path);               //Mounts a pack made by HImageManager::ImagePack_DevelopmentTool (mapped). Images named in it load from the pack instead of the disk, on first use like any file
+		bool OpenImagePack(const void* data, size_t size);  //Pack embedded in the executable. Not copied, it must stay valid while mounted
+		void CloseImagePacks();                             //Already cached images stay cached
+		bool GetPackedImageSize(const char* name, int& width, int& height);
+		bool GetImage(HBitImage& bit_image, size_t& bit_image_size, HImage*& image_out, float life_cycle = 1.5, CreateTextureCallback load = 0, DeleteTextureCallback unload = 0);  //Keyed by the content, hashed again only when the vector's buffer or bit_image_size changed
+		bool GetImage(const void* data, size_t size, uint64_t key, HImage*& image_out, float life_cycle = 1.5, CreateTextureCallback load = 0, DeleteTextureCallback unload = 0);  //Decodes the borrowed bytes in place. key 0 : the whole content is hashed on every call, for one-off use (see GetHandle)
+		HImageHandle GetHandle(const void* data, size_t size);  //Content key of the bytes, hashed once. Pass it every frame instead of hashing again
+		bool GetImage(const void* data, size_t size, HImageHandle handle, HImage*& image_out, float life_cycle = 1.5, CreateTextureCallback load = 0, DeleteTextureCallback unload = 0);
 		bool GetImage(const char* filename, HImage*& image_out, float life_cycle = 1.5, CreateTextureCallback load = 0, DeleteTextureCallback unload = 0);
 		inline HTextureID GetImage(const char* filename, float life_cycle = 1.5, CreateTextureCallback load = 0, DeleteTextureCallback unload = 0) { HImage* image; if (GetImage(filename, image, life_cycle, load, unload)) { return image->texture; } else { return 0; } }
+		HImageHandle GetHandle(const char* filename);  //Hashes and keeps the file name once. Store the handle and pass it every frame instead of the name
+		HImageRef GetImageRef(HImageHandle handle);     //Slot of the cached full resolution image of the handle, invalid while it is not cached
+		HImage* GetImage(HImageRef ref, float life_cycle = 1.5);  //Image in the slot without any lookup, 0 once the ref is stale : ask with the handle again
+		bool GetImage(HImageHandle handle, HImage*& image_out, float life_cycle = 1.5, CreateTextureCallback load = 0, DeleteTextureCallback unload = 0);
+		bool GetImage(const char* filename, const ImVec2& display_size, HImage*& image_out, float life_cycle = 1.5, CreateTextureCallback load = 0, DeleteTextureCallback unload = 0);  //See IO.DecodeToDisplaySize
+		bool GetImage(HImageHandle handle, const ImVec2& display_size, HImage*& image_out, float life_cycle = 1.5, CreateTextureCallback load = 0, DeleteTextureCallback unload = 0);
 #if HIMAGE_MANAGER_GIF_IMAGE_ENABLED
 		bool GetImage_gif(const char* filename, HImage*& image_out, float speed = 1000, float life_cycle = 1.5, CreateTextureCallback load = 0, DeleteTextureCallback unload = 0);
-		bool GetImage_gif(HBitImage& bit_image, size_t& bit_image_size, HImage*& image_out, float speed = 1000, float life_cycle = 1.5, CreateTextureCallback load = 0, DeleteTextureCallback unload = 0);
+		bool GetImage_gif(HImageHandle handle, HImage*& image_out, float speed = 1000, float life_cycle = 1.5, CreateTextureCallback load = 0, DeleteTextureCallback unload = 0);
+		bool GetImage_gif(HBitImage& bit_image, size_t& bit_image_size, HImage*& image_out, float speed = 1000, float life_cycle = 1.5, CreateTextureCallback load = 0, DeleteTextureCallback unload = 0);  //Keyed by the content, hashed again only when the vector's buffer or bit_image_size changed
+		bool GetImage_gif(const void* data, size_t size, uint64_t key, HImage*& image_out, float speed = 1000, float life_cycle = 1.5, CreateTextureCallback load = 0, DeleteTextureCallback unload = 0);  //The bytes are copied for the thread pool on a miss. key 0 : hashed on every call like GetImage
+		bool GetImage_gif(const void* data, size_t size, HImageHandle handle, HImage*& image_out, float speed = 1000, float life_cycle = 1.5, CreateTextureCallback load = 0, DeleteTextureCallback unload = 0);
 #endif
 #if HIMAGE_MANAGER_URL_IMAGE_ENABLED
 		bool GetImage_url(const char* url, const char* path, const char* id, HImage*& image_out, bool CacheFile = false, float life_cycle = 1.5, CreateTextureCallback load = 0, DeleteTextureCallback unload = 0);
@@ -99,11 +236,8 @@ namespace HImageManager
 
 	namespace DrawList
 	{
-		inline void AddImage(ImDrawList* draw_list, const char* filename, const ImVec2& p_min, const ImVec2& p_max, float life_cycle = 1.5, const ImVec2& uv_min = ImVec2(0, 0), const ImVec2& uv_max = ImVec2(1, 1), ImU32 col = IM_COL32_WHITE, CreateTextureCallback load = 0, DeleteTextureCallback unload = 0) { draw_list->AddImage(HImageManager::ImageLoader::GetImage(filename, life_cycle, load, unload), p_min, p_max, uv_min, uv_max, col); }
-		inline void AddImageRounded(ImDrawList* draw_list, const char* filename, const ImVec2& p_min, const ImVec2& p_max, float rounding, float life_cycle = 1.5, const ImVec2& uv_min = ImVec2(0, 0), const ImVec2& uv_max = ImVec2(1, 1), ImU32 col = IM_COL32_WHITE, ImDrawFlags flags = 0, CreateTextureCallback load = 0, DeleteTextureCallback unload = 0)
-		{
-			draw_list->AddImageRounded(HImageManager::ImageLoader::GetImage(filename, life_cycle, load, unload), p_min, p_max, uv_min, uv_max, col, rounding, flags);
-		}
+		void AddImage(ImDrawList* draw_list, const char* filename, const ImVec2& p_min, const ImVec2& p_max, float life_cycle = 1.5, const ImVec2& uv_min = ImVec2(0, 0), const ImVec2& uv_max = ImVec2(1, 1), ImU32 col = IM_COL32_WHITE, CreateTextureCallback load = 0, DeleteTextureCallback unload = 0, HImageManagerIO::DrawLoadingCallback draw_loading = 0);
+		void AddImageRounded(ImDrawList* draw_list, const char* filename, const ImVec2& p_min, const ImVec2& p_max, float rounding, float life_cycle = 1.5, const ImVec2& uv_min = ImVec2(0, 0), const ImVec2& uv_max = ImVec2(1, 1), ImU32 col = IM_COL32_WHITE, ImDrawFlags flags = 0, CreateTextureCallback load = 0, DeleteTextureCallback unload = 0, HImageManagerIO::DrawLoadingCallback draw_loading = 0);
 #if HIMAGE_MANAGER_GIF_IMAGE_ENABLED
 		void AddImage_gif(ImDrawList* draw_list, const char* filename, const ImVec2& p_min, const ImVec2& p_max, float speed = 1000, float life_cycle = 1.5, const ImVec2& uv_min = ImVec2(0, 0), const ImVec2& uv_max = ImVec2(1, 1), ImU32 col = IM_COL32_WHITE, HImageManagerIO::DrawLoadingCallback draw_loading = 0, CreateTextureCallback load = 0, DeleteTextureCallback unload = 0);
 		void AddImageRounded_gif(ImDrawList* draw_list, const char* filename, const ImVec2& p_min, const ImVec2& p_max, float rounding, float speed = 1000, float life_cycle = 1.5, const ImVec2& uv_min = ImVec2(0, 0), const ImVec2& uv_max = ImVec2(1, 1), ImU32 col = IM_COL32_WHITE, ImDrawFlags flags = 0, HImageManagerIO::DrawLoadingCallback draw_loading = 0, CreateTextureCallback load = 0, DeleteTextureCallback unload = 0);
@@ -119,7 +253,8 @@ namespace HImageManager
 
 	bool ImageButton_plus(const char* label, const char* Bace_ButtonImageFileName, const char* Hovered_ButtonImageFileName, const char* Active_ButtonImageFileName, const ImVec2& size_arg, float life_cycle = 1.5, const ImVec2& uv_min = ImVec2(0, 0), const ImVec2& uv_max = ImVec2(1, 1), CreateTextureCallback load = 0, DeleteTextureCallback unload = 0, ImGuiButtonFlags flags = ImGuiButtonFlags_None);
 	void Image(HBitImage& bit_image, size_t& bit_image_size, const ImVec2& size = ImVec2(150, 150), float rounding = 0, float life_cycle = 1.5, const ImVec2& uv0 = ImVec2(0, 0), const ImVec2& uv1 = ImVec2(1, 1), const ImVec4& tint_col = ImVec4(1, 1, 1, 1), const ImVec4& border_col = ImVec4(0, 0, 0, 0), CreateTextureCallback load = 0, DeleteTextureCallback unload = 0);
-	void Image(const char* filename, const ImVec2& size = ImVec2(150, 150), float rounding = 0, float life_cycle = 1.5, const ImVec2& uv0 = ImVec2(0, 0), const ImVec2& uv1 = ImVec2(1, 1), const ImVec4& tint_col = ImVec4(1, 1, 1, 1), const ImVec4& border_col = ImVec4(0, 0, 0, 0), CreateTextureCallback load = 0, DeleteTextureCallback unload = 0);
+	void Image(const char* filename, const ImVec2& size = ImVec2(150, 150), float rounding = 0, float life_cycle = 1.5, const ImVec2& uv0 = ImVec2(0, 0), const ImVec2& uv1 = ImVec2(1, 1), const ImVec4& tint_col = ImVec4(1, 1, 1, 1), const ImVec4& border_col = ImVec4(0, 0, 0, 0), CreateTextureCallback load = 0, DeleteTextureCallback unload = 0, HImageManagerIO::DrawLoadingCallback draw_loading = 0);
+	void Image(HImageHandle handle, const ImVec2& size = ImVec2(150, 150), float rounding = 0, float life_cycle = 1.5, const ImVec2& uv0 = ImVec2(0, 0), const ImVec2& uv1 = ImVec2(1, 1), const ImVec4& tint_col = ImVec4(1, 1, 1, 1), const ImVec4& border_col = ImVec4(0, 0, 0, 0), CreateTextureCallback load = 0, DeleteTextureCallback unload = 0, HImageManagerIO::DrawLoadingCallback draw_loading = 0);
 #if HIMAGE_MANAGER_GIF_IMAGE_ENABLED
 	void Image_gif(const char* filename, const ImVec2& size = ImVec2(150, 150), float speed = 1000, float life_cycle = 1.5, const ImVec2& uv0 = ImVec2(0, 0), const ImVec2& uv1 = ImVec2(1, 1), const ImVec4& tint_col = ImVec4(1, 1, 1, 1), const ImVec4& border_col = ImVec4(0, 0, 0, 0), CreateTextureCallback load = 0, DeleteTextureCallback unload = 0, HImageManagerIO::DrawLoadingCallback draw_loading = 0);
 	void Image_gif(HBitImage& bit_image, size_t& bit_image_size, const ImVec2& size = ImVec2(150, 150), float speed = 1000, float life_cycle = 1.5, const ImVec2& uv0 = ImVec2(0, 0), const ImVec2& uv1 = ImVec2(1, 1), const ImVec4& tint_col = ImVec4(1, 1, 1, 1), const ImVec4& border_col = ImVec4(0, 0, 0, 0), CreateTextureCallback load = 0, DeleteTextureCallback unload = 0, HImageManagerIO::DrawLoadingCallback draw_loading = 0);
@@ -137,7 +272,10 @@ namespace HImageManager
 #endif // (!_HAS_CXX17) && _WIN32
 #endif // HIMAGE_MANAGER_URL_IMAGE_ENABLED
 	void updata(float delta_time);
+	HImagePreloadHandle Preload(const char* const* filenames, int count, const HImagePreloadOptions& options = HImagePreloadOptions());  //Loads the images on the thread pool ahead of drawing them, ".gif" files as gifs. Cached and queued ones are not loaded again
+	void Shutdown();  //Waits for running loads and discards queued ones, pending preloads complete with them counted as failed. Call before destroying the rendering backend
 	const char* ImageToBitCode_DevelopmentTool(const char* filename, bool print = false);
+	bool ImagePack_DevelopmentTool(const char* pack_path, const char* const* filenames, int count, const char* const* names = 0);  //Writes the files into one pack for OpenImagePack, each found under its name (default : its file name)
 	void ShowResourceManager(bool* p_open = 0);
 }
 
@@ -150,7 +288,46 @@ glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);																							   \
 glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);																						   \
 glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);																						   \
-glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, w, h, 0, (fmt == 0) ? GL_BGRA : GL_RGBA, GL_UNSIGNED_BYTE, data);													   \
+glPixelStorei(GL_UNPACK_ALIGNMENT, 1);																														   \
+if (fmt == HImageFormat_R8 || fmt == HImageFormat_RG8)																										   \
+{																																							   \
+	GLint swizzle[4] = { GL_RED, GL_RED, GL_RED, (fmt == HImageFormat_R8) ? GL_ONE : GL_GREEN };															   \
+	glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, swizzle);																						   \
+}																																							   \
+if (fmt == HImageFormat_R8)																																	   \
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, w, h, 0, GL_RED, GL_UNSIGNED_BYTE, data);																			   \
+else if (fmt == HImageFormat_RG8)																															   \
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RG8, w, h, 0, GL_RG, GL_UNSIGNED_BYTE, data);																			   \
+else if (fmt == HImageFormat_RGB565)																														   \
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB565, w, h, 0, GL_RGB, GL_UNSIGNED_SHORT_5_6_5, data);																   \
+else																																						   \
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, w, h, 0, (fmt == 0) ? GL_BGRA : GL_RGBA, GL_UNSIGNED_BYTE, data);												   \
+glPixelStorei(GL_UNPACK_ALIGNMENT, 4);																														   \
+glBindTexture(GL_TEXTURE_2D, 0);																															   \
+return (void*)tex;																																			   \
+}																																							   \
+
+#define HImGuiImage_UpdateTextureCallBack_OpenGL [](void* tex, uint8_t* data, int w, int h, char fmt, int x, int y, int rect_w, int rect_h) {							   \
+glBindTexture(GL_TEXTURE_2D, (GLuint)(intptr_t)tex);																										   \
+glPixelStorei(GL_UNPACK_ROW_LENGTH, w);																														   \
+glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, rect_w, rect_h, (fmt == 0) ? GL_BGRA : GL_RGBA, GL_UNSIGNED_BYTE, data + ((size_t)y * w + x) * 4);					   \
+glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);																														   \
+glBindTexture(GL_TEXTURE_2D, 0);																															   \
+}																																							   \
+
+//IO.UploadFormats understood by HImGuiImage_CreateTextureCallBack_OpenGL without changing the blending (GL 3.3 swizzle). HImageFormat_RGB565 can be added when its precision is enough
+#define HImGuiImage_UploadFormats_OpenGL (HImageFormatFlag(HImageFormat_R8) | HImageFormatFlag(HImageFormat_RG8))
+
+#define HImGuiImage_CreateCompressedTextureCallBack_OpenGL [](uint8_t* blocks, size_t size, int w, int h, char fmt) -> void* {											   \
+GLuint tex;																																					   \
+																																							   \
+glGenTextures(1, &tex);																																		   \
+glBindTexture(GL_TEXTURE_2D, tex);																															   \
+glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);																							   \
+glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);																							   \
+glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);																						   \
+glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);																						   \
+glCompressedTexImage2D(GL_TEXTURE_2D, 0, (fmt == HImageFormat_BC1) ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, w, h, 0, (GLsizei)size, blocks); \
 glBindTexture(GL_TEXTURE_2D, 0);																															   \
 return (void*)tex;																																			   \
 }																																							   \
@@ -0,0 +1,59 @@
+//
+//  image_ref_test.cpp
+//
+//  Evicts and reloads one cached image until its slot has gone through every HImageRef generation, and checks
+//  that no ref handed out before an eviction ever resolves again.
+//  Build next to the library, with Dear ImGui and stb_image.h on the include path :
+//      g++ -std=c++17 -I. -I<imgui> tests/image_ref_test.cpp HImGuiImageManager.cpp <imgui>/imgui*.cpp
+//
+#include "HImGuiImageManager.h"
+#include <stdio.h>
+#include <vector>
+
+//2x2 binary ppm, decoded by stb_image
+static const char TestImage[] = "P6\n2 2\n255\n\xff\x00\x00\x00\xff\x00\x00\x00\xff\xff\xff\xff";
+
+static int failures = 0;
+
+static void Check(bool condition, const char* what)
+{
+	printf("%s : %s\n", condition ? "ok  " : "FAIL", what);
+	if (!condition)
+		failures++;
+}
+
+int main()
+{
+	ImGui::CreateContext();
+	HImageManagerIO& io = HImageManager::GetIO();
+	io.CreateTexture = [](uint8_t*, int, int, char) -> HTextureID { return (HTextureID)1; };
+	io.DeleteTexture = [](HTextureID) {};
+
+	HImageHandle handle = HImageManager::ImageLoader::GetHandle(TestImage, sizeof(TestImage) - 1);
+	const float life_cycle = 1;
+	const int cycles = 5000;  //More than the 4095 generations of a slot
+	std::vector<HImageRef> refs;
+	bool loaded = true, fresh = true, stale = true;
+	for (int i = 0; i < cycles; i++)
+	{
+		HImage* image = 0;
+		loaded = loaded && HImageManager::ImageLoader::GetImage(TestImage, sizeof(TestImage) - 1, handle, image, life_cycle);
+		HImageRef ref = HImageManager::ImageLoader::GetImageRef(handle);
+		fresh = fresh && ref.IsValid() && HImageManager::ImageLoader::GetImage(ref, life_cycle) == image;
+		for (size_t r = 0; r < refs.size(); r++)
+			stale = stale && !HImageManager::ImageLoader::GetImage(refs[r], life_cycle);
+		refs.push_back(ref);
+		if (refs.size() > 64)
+			refs.erase(refs.begin() + 1);  //Keeps the first ref, and the latest ones
+		HImageManager::updata(life_cycle * 2);  //Evicts the image, its slot is free for the next load
+	}
+	Check(loaded, "the image loaded every cycle");
+	Check(fresh, "the ref of the cached image finds it");
+	Check(stale, "refs from before an eviction stay stale, past the generation wrap");
+	Check(!HImageManager::ImageLoader::GetImageRef(handle).IsValid(), "no ref once the image is evicted");
+
+	HImageManager::Shutdown();
+	ImGui::DestroyContext();
+	printf(failures ? "%d check(s) failed\n" : "all checks passed\n", failures);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,53 @@
+//
+//  preload_test.cpp
+//
+//  Checks the progress a preload reports, starting with an empty one.
+//  Build next to the library, with Dear ImGui and stb_image.h on the include path :
+//      g++ -std=c++17 -I. -I<imgui> tests/preload_test.cpp HImGuiImageManager.cpp <imgui>/imgui*.cpp -pthread
+//
+#include "HImGuiImageManager.h"
+#include <stdio.h>
+#include <chrono>
+
+static int failures = 0;
+static int completed = 0;
+
+static void Check(bool condition, const char* what)
+{
+	printf("%s : %s\n", condition ? "ok  " : "FAIL", what);
+	if (!condition)
+		failures++;
+}
+
+int main()
+{
+	ImGui::CreateContext();
+	HImageManagerIO& io = HImageManager::GetIO();
+	io.CreateTexture = [](uint8_t*, int, int, char) -> HTextureID { return (HTextureID)1; };
+	io.DeleteTexture = [](HTextureID) {};
+
+	//Empty : nothing loaded, already complete
+	HImagePreloadOptions options;
+	options.on_complete = [](const HImagePreloadHandle&, void*) { completed++; };
+	HImagePreloadHandle empty = HImageManager::Preload(0, 0, options);
+	Check(empty.Total() == 0, "empty preload : total 0");
+	Check(empty.Loaded() == 0, "empty preload : loaded 0");
+	Check(empty.Failed() == 0, "empty preload : failed 0");
+	Check(empty.Progress() == 1.0f, "empty preload : progress 1");
+	Check(empty.IsDone(), "empty preload : done");
+	Check(empty.future.wait_for(std::chrono::seconds(0)) == std::future_status::ready, "empty preload : future ready");
+	Check(completed == 1, "empty preload : on_complete called once");
+
+	//Missing files count as loaded and failed
+	const char* missing[] = { "preload_test_missing_1.png", "preload_test_missing_2.png" };
+	HImagePreloadHandle handle = HImageManager::Preload(missing, 2, options);
+	handle.Wait();
+	Check(handle.Total() == 2 && handle.Loaded() == 2 && handle.Failed() == 2, "missing files : 2 loaded, 2 failed");
+	Check(handle.Progress() == 1.0f, "missing files : progress 1");
+	Check(completed == 2, "missing files : on_complete called once");
+
+	HImageManager::Shutdown();
+	ImGui::DestroyContext();
+	printf(failures ? "%d check(s) failed\n" : "all checks passed\n", failures);
+	return failures ? 1 : 0;
+}
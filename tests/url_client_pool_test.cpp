@@ -0,0 +1,152 @@
+//
+//  url_client_pool_test.cpp
+//
+//  Loads url images from a local httplib::Server and checks that the url client pool reuses its keep-alive
+//  connections, never opens more than IO.UrlMaxConnectionsPerHost to one host and resumes every load it parked.
+//  Build next to the library, with Dear ImGui, stb_image.h and httplib.h on the include path :
+//      g++ -std=c++17 -DHIMAGE_MANAGER_URL_IMAGE_ENABLED=1 -I. -I<imgui> tests/url_client_pool_test.cpp HImGuiImageManager.cpp <imgui>/imgui*.cpp -pthread
+//
+#include "HImGuiImageManager.h"
+#include "httplib.h"
+#include <stdio.h>
+#include <string>
+#include <set>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <chrono>
+
+#if !HIMAGE_MANAGER_URL_IMAGE_ENABLED
+#error Build with -DHIMAGE_MANAGER_URL_IMAGE_ENABLED=1
+#endif
+
+//2x2 binary ppm, decoded by stb_image
+static const char TestImage[] = "P6\n2 2\n255\n\xff\x00\x00\x00\xff\x00\x00\x00\xff\xff\xff\xff";
+
+struct TestServer
+{
+	httplib::Server server;
+	std::thread thread;
+	int port = 0;
+	std::mutex mutex;
+	std::set<int> remote_ports;  //One per tcp connection
+	std::atomic<int> in_flight{ 0 };
+	std::atomic<int> peak_in_flight{ 0 };
+	std::atomic<int> requests{ 0 };
+
+	bool Start()
+	{
+		server.set_keep_alive_max_count(1000);
+		server.Get(R"(/img/(\d+))", [this](const httplib::Request& req, httplib::Response& res)
+			{
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					remote_ports.insert(req.remote_port);
+				}
+				int now = ++in_flight;
+				int peak = peak_in_flight;
+				while (now > peak && !peak_in_flight.compare_exchange_weak(peak, now))
+					;
+				std::this_thread::sleep_for(std::chrono::milliseconds(20));  //Keeps the loads overlapping
+				res.set_content(TestImage, sizeof(TestImage) - 1, "image/x-portable-pixmap");
+				requests++;
+				in_flight--;
+			});
+		port = server.bind_to_any_port("127.0.0.1");
+		if (port <= 0)
+			return false;
+		thread = std::thread([this]() { server.listen_after_bind(); });
+		server.wait_until_ready();
+		return true;
+	}
+
+	void Stop()
+	{
+		server.stop();
+		if (thread.joinable())
+			thread.join();
+	}
+
+	int Connections()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return (int)remote_ports.size();
+	}
+};
+
+//Asks for images first..first+count-1 every frame until they are all uploaded
+static bool LoadImages(const std::string& url, int first, int count)
+{
+	auto start = std::chrono::steady_clock::now();
+	while (std::chrono::steady_clock::now() - start < std::chrono::seconds(20))
+	{
+		int loaded = 0;
+		for (int i = first; i < first + count; i++)
+		{
+			std::string path = "/img/" + std::to_string(i);
+			std::string id = "pool_test_" + std::to_string(i);
+			HImage* image = 0;
+			if (HImageManager::ImageLoader::GetImage_url(url.c_str(), path.c_str(), id.c_str(), image, false, 60))
+				loaded++;
+		}
+		if (loaded == count)
+			return true;
+		HImageManager::updata(0.016f);
+		std::this_thread::sleep_for(std::chrono::milliseconds(2));
+	}
+	return false;
+}
+
+static int failures = 0;
+
+static void Check(bool condition, const char* what)
+{
+	printf("%s : %s\n", condition ? "ok  " : "FAIL", what);
+	if (!condition)
+		failures++;
+}
+
+int main()
+{
+	ImGui::CreateContext();
+	HImageManagerIO& io = HImageManager::GetIO();
+	io.CreateTexture = [](uint8_t*, int, int, char) -> HTextureID { return (HTextureID)1; };
+	io.DeleteTexture = [](HTextureID) {};
+	io.ThreadPoolMaximumNuberOfThreads = 8;
+	io.UrlMaxConnectionsPerHost = 2;
+
+	TestServer server;
+	if (!server.Start())
+	{
+		printf("FAIL : could not start the local server\n");
+		return 1;
+	}
+	std::string url = "http://127.0.0.1:" + std::to_string(server.port);
+
+	//Pooled : 24 loads on 8 workers share at most 2 connections
+	const int pooled = 24;
+	Check(LoadImages(url, 0, pooled), "pooled images loaded");
+	HImageUrlPoolStats stats = io.GetUrlPoolStats();
+	printf("       server connections %d, peak in flight %d, opened %d, reused %d\n", server.Connections(), server.peak_in_flight.load(), stats.ConnectionsOpened, stats.ConnectionsReused);
+	Check(server.Connections() <= io.UrlMaxConnectionsPerHost, "server saw at most UrlMaxConnectionsPerHost connections");
+	Check(server.peak_in_flight <= io.UrlMaxConnectionsPerHost, "at most UrlMaxConnectionsPerHost requests in flight");
+	Check(stats.PeakConnectionsPerHost <= io.UrlMaxConnectionsPerHost, "pool stayed within the limit");
+	Check(stats.ConnectionsReused >= pooled - io.UrlMaxConnectionsPerHost, "the other loads reused a keep-alive connection");
+	Check(stats.ParkedLoads == 0, "every parked load was resumed");
+
+	//Unpooled : a connection per load
+	io.UrlMaxConnectionsPerHost = 0;
+	const int unpooled = 6;
+	int opened_before = stats.ConnectionsOpened;
+	int reused_before = stats.ConnectionsReused;
+	Check(LoadImages(url, pooled, unpooled), "unpooled images loaded");
+	stats = io.GetUrlPoolStats();
+	Check(stats.ConnectionsOpened - opened_before == unpooled, "UrlMaxConnectionsPerHost 0 opens a connection per load");
+	Check(stats.ConnectionsReused == reused_before, "UrlMaxConnectionsPerHost 0 reuses nothing");
+
+	HImageManager::Shutdown();
+	server.Stop();
+	ImGui::DestroyContext();
+	printf(failures ? "%d check(s) failed\n" : "all checks passed\n", failures);
+	return failures ? 1 : 0;
+}